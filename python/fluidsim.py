@@ -0,0 +1,245 @@
+"""Python bindings for libfluidsim through ctypes.
+
+Particle fields are NumPy views aliasing engine memory, so reading or writing them copies
+nothing. Every view keeps that memory alive: a closed world is only destroyed once the last
+view into it is gone. Calls into the library go through ctypes.CDLL, which releases the GIL,
+so other Python threads keep running while step() advances the simulation. Every method of a
+closed world raises ValueError.
+
+    from fluidsim import World
+    with World(particles=100000, threads=8) as world:
+        world.set_parameters(gravity=0.5)
+        world.step(100)
+        x, y = world.positions.T
+
+Build the library with `make lib`. It is loaded from $FLUIDSIM_LIBRARY, or from the
+repository root next to this directory.
+"""
+
+import ctypes
+import os
+
+import numpy as np
+
+API_VERSION = 1
+
+X_POSITION, Y_POSITION, X_VELOCITY, Y_VELOCITY, RADIUS = range(5)
+
+
+class _WorldDesc(ctypes.Structure):
+    _fields_ = [
+        ("numParticles", ctypes.c_int),
+        ("scenePath", ctypes.c_char_p),
+        ("boundaryPath", ctypes.c_char_p),
+        ("numThreads", ctypes.c_int),
+    ]
+
+
+class _Parameters(ctypes.Structure):
+    _fields_ = [
+        ("seed", ctypes.c_uint64),
+        ("timestep", ctypes.c_float),
+        ("gravity", ctypes.c_float),
+        ("restitution", ctypes.c_float),
+        ("forcingAmplitude", ctypes.c_float),
+        ("periodicX", ctypes.c_int32),
+        ("periodicY", ctypes.c_int32),
+        ("timestepLevels", ctypes.c_int32),
+        ("longRangeMode", ctypes.c_int32),
+        ("longRangeStrength", ctypes.c_float),
+        ("longRangeTheta", ctypes.c_float),
+    ]
+
+
+# Python names of the FluidParameters fields
+_PARAMETER_NAMES = {
+    "seed": "seed",
+    "timestep": "timestep",
+    "gravity": "gravity",
+    "restitution": "restitution",
+    "forcing": "forcingAmplitude",
+    "periodic_x": "periodicX",
+    "periodic_y": "periodicY",
+    "timestep_levels": "timestepLevels",
+    "long_range_mode": "longRangeMode",
+    "long_range_strength": "longRangeStrength",
+    "long_range_theta": "longRangeTheta",
+}
+
+
+def _load_library():
+    path = os.environ.get("FLUIDSIM_LIBRARY")
+    if not path:
+        root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+        path = os.path.join(root, "libfluidsim.so")
+    lib = ctypes.CDLL(path)
+
+    world = ctypes.c_void_p
+    signatures = {
+        "FluidWorld_Create": (world, [ctypes.POINTER(_WorldDesc)]),
+        "FluidWorld_Step": (None, [world, ctypes.c_int]),
+        "FluidWorld_GetParameters": (None, [world, ctypes.POINTER(_Parameters)]),
+        "FluidWorld_SetParameters": (None, [world, ctypes.POINTER(_Parameters)]),
+        "FluidWorld_Capacity": (ctypes.c_int, [world]),
+        "FluidWorld_ActiveCount": (ctypes.c_int, [world]),
+        "FluidWorld_StepIndex": (ctypes.c_longlong, [world]),
+        "FluidWorld_Field": (ctypes.c_void_p, [world, ctypes.c_int, ctypes.POINTER(ctypes.c_size_t)]),
+        "FluidWorld_DensityPressure": (None, [world, ctypes.c_void_p, ctypes.c_void_p]),
+        "FluidWorld_SaveCheckpoint": (ctypes.c_int, [world, ctypes.c_char_p]),
+        "FluidWorld_LoadCheckpoint": (ctypes.c_int, [world, ctypes.c_char_p]),
+        "FluidWorld_StateHash": (ctypes.c_uint64, [world]),
+        "FluidWorld_Destroy": (None, [world]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        function = getattr(lib, name)
+        function.restype = restype
+        function.argtypes = argtypes
+    return lib
+
+
+_lib = _load_library()
+
+
+def _encode(path):
+    return os.fsencode(path) if path is not None else None
+
+
+class _Handle:
+    """Owns an engine world and destroys it when the last reference goes away. The World and the
+    buffer behind every field view both refer to it."""
+
+    def __init__(self, pointer):
+        self.pointer = pointer
+        self._destroy = _lib.FluidWorld_Destroy  # still reachable during interpreter shutdown
+
+    def __del__(self):
+        if self.pointer:
+            self._destroy(self.pointer)
+            self.pointer = None
+
+
+class World:
+    """One simulation world. The solver keeps global settings, so only one can be open at a time."""
+
+    def __init__(self, particles=1000, scene=None, boundary=None, threads=0):
+        self._handle = None
+        self._owner = None
+        desc = _WorldDesc(particles, _encode(scene), _encode(boundary), threads)
+        self._handle = _lib.FluidWorld_Create(ctypes.byref(desc))
+        if not self._handle:
+            raise RuntimeError("could not create fluid world")
+        self._owner = _Handle(self._handle)
+        self._records = self._map_records()
+
+    def _map_records(self):
+        # The whole record array as one byte buffer, every field view is a strided slice of it
+        stride = ctypes.c_size_t()
+        base = _lib.FluidWorld_Field(self._handle, X_POSITION, ctypes.byref(stride))
+        self._stride = stride.value
+        size = self.capacity * self._stride
+        memory = (ctypes.c_ubyte * size).from_address(base)
+        memory._owner = self._owner  # views reach this buffer through their base chain
+        return np.ctypeslib.as_array(memory)
+
+    def _check_open(self):
+        # The C API takes no NULL world, so a closed world must never reach it
+        if self._handle is None:
+            raise ValueError("world is closed")
+
+    def _view(self, field, components):
+        self._check_open()
+        count = self.active_count
+        offset = _lib.FluidWorld_Field(self._handle, field, None) - self._records.ctypes.data
+        shape = (count, components) if components > 1 else (count,)
+        strides = (self._stride, 4) if components > 1 else (self._stride,)
+        return np.ndarray(shape, dtype=np.float32, buffer=self._records, offset=offset, strides=strides)
+
+    @property
+    def positions(self):
+        """(active_count, 2) float32 view of x, y."""
+        return self._view(X_POSITION, 2)
+
+    @property
+    def velocities(self):
+        """(active_count, 2) float32 view of the x and y velocities."""
+        return self._view(X_VELOCITY, 2)
+
+    @property
+    def radii(self):
+        """(active_count,) float32 view of the radii."""
+        return self._view(RADIUS, 1)
+
+    @property
+    def capacity(self):
+        self._check_open()
+        return _lib.FluidWorld_Capacity(self._handle)
+
+    @property
+    def active_count(self):
+        self._check_open()
+        return _lib.FluidWorld_ActiveCount(self._handle)
+
+    @property
+    def step_index(self):
+        self._check_open()
+        return _lib.FluidWorld_StepIndex(self._handle)
+
+    def step(self, steps=1):
+        """Advance by the given number of steps with the GIL released."""
+        self._check_open()
+        _lib.FluidWorld_Step(self._handle, int(steps))
+
+    def parameters(self):
+        self._check_open()
+        values = _Parameters()
+        _lib.FluidWorld_GetParameters(self._handle, ctypes.byref(values))
+        return {name: getattr(values, field) for name, field in _PARAMETER_NAMES.items()}
+
+    def set_parameters(self, **changes):
+        self._check_open()
+        values = _Parameters()
+        _lib.FluidWorld_GetParameters(self._handle, ctypes.byref(values))
+        for name, value in changes.items():
+            if name not in _PARAMETER_NAMES:
+                raise KeyError(f"unknown parameter {name!r}")
+            setattr(values, _PARAMETER_NAMES[name], value)
+        _lib.FluidWorld_SetParameters(self._handle, ctypes.byref(values))
+
+    def density_pressure(self):
+        """Density and pressure of the active particles, as new arrays."""
+        self._check_open()
+        count = self.active_count
+        density = np.empty(count, dtype=np.float32)
+        pressure = np.empty(count, dtype=np.float32)
+        _lib.FluidWorld_DensityPressure(self._handle, density.ctypes.data, pressure.ctypes.data)
+        return density, pressure
+
+    def save_checkpoint(self, path):
+        self._check_open()
+        if _lib.FluidWorld_SaveCheckpoint(self._handle, _encode(path)) != 0:
+            raise OSError(f"could not write checkpoint {path}")
+
+    def load_checkpoint(self, path):
+        self._check_open()
+        if _lib.FluidWorld_LoadCheckpoint(self._handle, _encode(path)) != 0:
+            raise OSError(f"could not load checkpoint {path}")
+
+    def state_hash(self):
+        self._check_open()
+        return _lib.FluidWorld_StateHash(self._handle)
+
+    def close(self):
+        """Close the world. The engine world is destroyed as soon as no view handed out before
+        refers to it any more, and only then can a new World be created."""
+        self._handle = None
+        self._records = None
+        self._owner = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
@@ -0,0 +1,77 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+int Arena_Init(Arena* arena, size_t capacity) {
+    memset(arena, 0, sizeof(*arena));
+
+    // Reserve address space only, pages are committed on first touch and stay committed across resets
+    void* base = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+        madvise(base, capacity, MADV_HUGEPAGE);
+#endif
+        arena->mapped = 1;
+    } else {
+        base = malloc(capacity);
+        if (!base) {
+            fprintf(stderr, "Failed to allocate %zu bytes for arena\n", capacity);
+            return -1;
+        }
+    }
+    arena->base = base;
+    arena->capacity = capacity;
+    return 0;
+}
+
+void* Arena_Alloc(Arena* arena, size_t size, size_t alignment) {
+    uintptr_t start = ((uintptr_t)arena->base + arena->offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    size_t end = (size_t)(start - (uintptr_t)arena->base) + size;
+    if (end > arena->capacity) return NULL;
+    arena->offset = end;
+    if (end > arena->peak) arena->peak = end;
+    return (void*)start;
+}
+
+void Arena_Reset(Arena* arena) {
+    arena->offset = 0;
+}
+
+void Arena_Destroy(Arena* arena) {
+    if (arena->mapped) {
+        munmap(arena->base, arena->capacity);
+    } else {
+        free(arena->base);
+    }
+    memset(arena, 0, sizeof(*arena));
+}
+
+// Rounded to whole huge pages so both mapping kinds are unmapped with the same length
+static size_t hugePageLength(size_t size) {
+    return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+void* HugePages_Alloc(size_t size) {
+    size_t length = hugePageLength(size > 0 ? size : 1);
+    void* memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (memory == MAP_FAILED) {
+        // No reserved huge pages, fall back to transparent ones
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) return NULL;
+#ifdef MADV_HUGEPAGE
+        madvise(memory, length, MADV_HUGEPAGE);
+#endif
+    }
+    return memory;
+}
+
+void HugePages_Free(void* memory, size_t size) {
+    if (memory) munmap(memory, hugePageLength(size > 0 ? size : 1));
+}
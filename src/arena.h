@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Linear allocator for scratch memory that lives for one simulation step: allocations bump an
+// offset and Arena_Reset frees everything at once. Backed by one reserved (huge-page advised)
+// mapping, so a warmed-up arena never touches the heap.
+typedef struct {
+    unsigned char* base;
+    size_t capacity;
+    size_t offset;
+    size_t peak;           // highest offset reached since Arena_Init
+    int mapped;            // base came from mmap rather than malloc
+} Arena;
+
+int Arena_Init(Arena* arena, size_t capacity);
+void* Arena_Alloc(Arena* arena, size_t size, size_t alignment); // NULL when the arena is full
+void Arena_Reset(Arena* arena);
+void Arena_Destroy(Arena* arena);
+
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+#define ARENA_ARRAY(arena, Type, count) ((Type*)Arena_Alloc((arena), sizeof(Type) * (size_t)(count), _Alignof(Type)))
+
+// Large long-lived arrays (particle storage): explicit huge pages when the system has some reserved,
+// otherwise a regular mapping advised for transparent huge pages. Pages are left untouched so the
+// caller decides which thread faults each one in.
+void* HugePages_Alloc(size_t size); // NULL when out of memory
+void HugePages_Free(void* memory, size_t size);
+
+#endif // ARENA_H
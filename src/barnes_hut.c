@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include "barnes_hut.h"
+#include "jobs.h"
+
+#define LEAF_SIZE 8
+#define MAX_DEPTH 24
+#define PARALLEL_BUILD_THRESHOLD 4096 // below this the quadrants are built on the calling thread
+#define PARTICLES_PER_JOB 256
+#define TRAVERSAL_STACK 256
+
+typedef struct {
+    QuadNode* nodes;
+    int count, capacity;
+} NodeArray;
+
+typedef struct {
+    const QuadTree* tree;
+    const Circle* circles;
+    float strength, thetaSquared;
+    float xPeriod, yPeriod;           // 0 on non-periodic axes
+    float *xAcc, *yAcc;
+} AccelerationPass;
+
+// Work item for building one root quadrant
+typedef struct {
+    NodeArray nodes;
+    const Circle* circles;
+    int* order;
+    int start, count;
+    float xCenter, yCenter, halfSize;
+} SubtreeBuild;
+
+static int reserveNodes(NodeArray* array, int count) {
+    if (array->count + count > array->capacity) {
+        int capacity = array->capacity ? array->capacity : 64;
+        while (array->count + count > capacity) capacity *= 2;
+        QuadNode* grown = realloc(array->nodes, sizeof(QuadNode) * capacity);
+        if (!grown) {
+            fprintf(stderr, "Failed to allocate memory for quadtree\n");
+            exit(EXIT_FAILURE);
+        }
+        array->nodes = grown;
+        array->capacity = capacity;
+    }
+    int first = array->count;
+    array->count += count;
+    return first;
+}
+
+// In-place partition of order[start .. start+count) on one axis, returns the number of entries below the split
+static int partition(const Circle* circles, int* order, int start, int count, int axis, float split) {
+    int i = start, j = start + count - 1;
+    while (i <= j) {
+        const Circle* c = &circles[order[i]];
+        float value = axis == 0 ? c->xPos : c->yPos;
+        if (value < split) {
+            i++;
+        } else {
+            int tmp = order[i];
+            order[i] = order[j];
+            order[j--] = tmp;
+        }
+    }
+    return i - start;
+}
+
+// Split a run of particles into quadrants (SW, SE, NW, NE), quadrantCount receives the 4 run lengths
+static void splitQuadrants(const Circle* circles, int* order, int start, int count,
+                           float xCenter, float yCenter, int* quadrantCount) {
+    int below = partition(circles, order, start, count, 1, yCenter);
+    quadrantCount[0] = partition(circles, order, start, below, 0, xCenter);
+    quadrantCount[1] = below - quadrantCount[0];
+    quadrantCount[2] = partition(circles, order, start + below, count - below, 0, xCenter);
+    quadrantCount[3] = count - below - quadrantCount[2];
+}
+
+static void finishLeaf(QuadNode* node, const Circle* circles, const int* order) {
+    node->firstChild = -1;
+    node->mass = node->xMass = node->yMass = 0.0f;
+    for (int k = node->start; k < node->start + node->count; k++) {
+        const Circle* c = &circles[order[k]];
+        float m = c->radius * c->radius;
+        node->mass += m;
+        node->xMass += m * c->xPos;
+        node->yMass += m * c->yPos;
+    }
+    if (node->mass > 0.0f) {
+        node->xMass /= node->mass;
+        node->yMass /= node->mass;
+    }
+}
+
+// Centre of mass of an internal node from its 4 children
+static void finishInternal(QuadNode* nodes, int index) {
+    QuadNode* node = &nodes[index];
+    node->mass = node->xMass = node->yMass = 0.0f;
+    for (int q = 0; q < 4; q++) {
+        const QuadNode* child = &nodes[node->firstChild + q];
+        node->mass += child->mass;
+        node->xMass += child->mass * child->xMass;
+        node->yMass += child->mass * child->yMass;
+    }
+    if (node->mass > 0.0f) {
+        node->xMass /= node->mass;
+        node->yMass /= node->mass;
+    }
+}
+
+static void buildNode(NodeArray* array, int index, const Circle* circles, int* order, int start, int count,
+                      float xCenter, float yCenter, float halfSize, int depth) {
+    QuadNode* node = &array->nodes[index];
+    node->xCenter = xCenter;
+    node->yCenter = yCenter;
+    node->halfSize = halfSize;
+    node->start = start;
+    node->count = count;
+
+    if (count <= LEAF_SIZE || depth >= MAX_DEPTH) {
+        finishLeaf(node, circles, order);
+        return;
+    }
+
+    int quadrantCount[4];
+    splitQuadrants(circles, order, start, count, xCenter, yCenter, quadrantCount);
+
+    int firstChild = reserveNodes(array, 4); // may move array->nodes
+    array->nodes[index].firstChild = firstChild;
+    float quarter = halfSize * 0.5f;
+    for (int q = 0; q < 4; q++) {
+        float x = xCenter + ((q & 1) ? quarter : -quarter);
+        float y = yCenter + ((q & 2) ? quarter : -quarter);
+        buildNode(array, firstChild + q, circles, order, start, quadrantCount[q], x, y, quarter, depth + 1);
+        start += quadrantCount[q];
+    }
+    finishInternal(array->nodes, index);
+}
+
+static void buildSubtree(SubtreeBuild* build) {
+    build->nodes.count = 0;
+    reserveNodes(&build->nodes, 1);
+    buildNode(&build->nodes, 0, build->circles, build->order, build->start, build->count,
+              build->xCenter, build->yCenter, build->halfSize, 1);
+}
+
+static void buildSubtreeJob(Job* job, void* data) {
+    (void)job;
+    buildSubtree(*(SubtreeBuild**)data);
+}
+
+static void groupJob(Job* job, void* data) {
+    (void)job;
+    (void)data;
+}
+
+void QuadTree_Build(QuadTree* tree, const Circle* circles, int numCircles) {
+    SubtreeBuild quadrants[4];
+
+    if (numCircles > tree->orderCapacity) {
+        int* grown = realloc(tree->order, sizeof(int) * numCircles);
+        if (!grown) {
+            fprintf(stderr, "Failed to allocate memory for quadtree\n");
+            exit(EXIT_FAILURE);
+        }
+        tree->order = grown;
+        tree->orderCapacity = numCircles;
+    }
+
+    // Square root cell around all particles
+    float xMin = INFINITY, yMin = INFINITY, xMax = -INFINITY, yMax = -INFINITY;
+    for (int i = 0; i < numCircles; i++) {
+        tree->order[i] = i;
+        xMin = fminf(xMin, circles[i].xPos);
+        xMax = fmaxf(xMax, circles[i].xPos);
+        yMin = fminf(yMin, circles[i].yPos);
+        yMax = fmaxf(yMax, circles[i].yPos);
+    }
+    if (numCircles == 0) xMin = yMin = xMax = yMax = 0.0f;
+    float xCenter = 0.5f * (xMin + xMax);
+    float yCenter = 0.5f * (yMin + yMax);
+    float halfSize = 0.5f * fmaxf(xMax - xMin, yMax - yMin) + 1e-6f;
+
+    int quadrantCount[4];
+    splitQuadrants(circles, tree->order, 0, numCircles, xCenter, yCenter, quadrantCount);
+
+    // The quadrant subtrees are independent, build them as jobs under one group
+    Job* group = numCircles >= PARALLEL_BUILD_THRESHOLD ? Job_Create(groupJob, NULL, 0, NULL) : NULL;
+    int start = 0;
+    float quarter = halfSize * 0.5f;
+    for (int q = 0; q < 4; q++) {
+        quadrants[q].nodes.nodes = tree->quadrantNodes[q];
+        quadrants[q].nodes.capacity = tree->quadrantCapacity[q];
+        quadrants[q].circles = circles;
+        quadrants[q].order = tree->order;
+        quadrants[q].start = start;
+        quadrants[q].count = quadrantCount[q];
+        quadrants[q].xCenter = xCenter + ((q & 1) ? quarter : -quarter);
+        quadrants[q].yCenter = yCenter + ((q & 2) ? quarter : -quarter);
+        quadrants[q].halfSize = quarter;
+        start += quadrantCount[q];
+        if (group) {
+            SubtreeBuild* build = &quadrants[q];
+            Job_Run(Job_Create(buildSubtreeJob, &build, sizeof(build), group));
+        } else {
+            buildSubtree(&quadrants[q]);
+        }
+    }
+    if (group) {
+        Job_Run(group);
+        Job_Wait(group);
+    }
+
+    // Merge: root, the 4 quadrant roots, then the remaining nodes of each quadrant
+    int total = 5;
+    for (int q = 0; q < 4; q++) {
+        tree->quadrantNodes[q] = quadrants[q].nodes.nodes;
+        tree->quadrantCapacity[q] = quadrants[q].nodes.capacity;
+        total += quadrants[q].nodes.count - 1;
+    }
+    if (total > tree->nodeCapacity) {
+        QuadNode* grown = realloc(tree->nodes, sizeof(QuadNode) * total);
+        if (!grown) {
+            fprintf(stderr, "Failed to allocate memory for quadtree\n");
+            exit(EXIT_FAILURE);
+        }
+        tree->nodes = grown;
+        tree->nodeCapacity = total;
+    }
+
+    int base = 5;
+    for (int q = 0; q < 4; q++) {
+        const NodeArray* local = &quadrants[q].nodes;
+        // local node 0 goes to slot 1 + q, local node m >= 1 to base + m - 1
+        for (int m = 0; m < local->count; m++) {
+            QuadNode node = local->nodes[m];
+            if (node.firstChild >= 0) node.firstChild += base - 1;
+            tree->nodes[m == 0 ? 1 + q : base + m - 1] = node;
+        }
+        base += local->count - 1;
+    }
+
+    QuadNode* root = &tree->nodes[0];
+    root->xCenter = xCenter;
+    root->yCenter = yCenter;
+    root->halfSize = halfSize;
+    root->firstChild = 1;
+    root->start = 0;
+    root->count = numCircles;
+    finishInternal(tree->nodes, 0);
+    tree->numNodes = total;
+}
+
+// Nearest image of an offset on an axis with the given period, 0 for none
+static float nearestImage(float offset, float period) {
+    return period > 0.0f ? offset - period * roundf(offset / period) : offset;
+}
+
+// Whether a cell reaches half a period from the particle, where its particles switch images
+static bool crossesImageBoundary(float centreOffset, float halfSize, float period) {
+    return period > 0.0f && fabsf(nearestImage(centreOffset, period)) + halfSize >= 0.5f * period;
+}
+
+static void accelerationRange(int begin, int end, void* context) {
+    const AccelerationPass* pass = context;
+    const QuadTree* tree = pass->tree;
+    const Circle* circles = pass->circles;
+    float thetaSquared = pass->thetaSquared;
+    float xPeriod = pass->xPeriod, yPeriod = pass->yPeriod;
+
+    for (int i = begin; i < end; i++) {
+        const Circle* c = &circles[i];
+        float softening = c->radius * c->radius; // keeps touching particles from blowing up
+        float ax = 0.0f, ay = 0.0f;
+
+        int stack[TRAVERSAL_STACK];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const QuadNode* node = &tree->nodes[stack[--top]];
+            if (node->mass == 0.0f) continue;
+
+            float dx = nearestImage(node->xMass - c->xPos, xPeriod);
+            float dy = nearestImage(node->yMass - c->yPos, yPeriod);
+            float distanceSquared = dx * dx + dy * dy;
+            float size = 2.0f * node->halfSize;
+            bool mixedImages = crossesImageBoundary(node->xCenter - c->xPos, node->halfSize, xPeriod) ||
+                               crossesImageBoundary(node->yCenter - c->yPos, node->halfSize, yPeriod);
+
+            if (node->firstChild >= 0 && (mixedImages || size * size >= thetaSquared * distanceSquared)) {
+                // Too close to approximate, open the cell
+                for (int q = 0; q < 4 && top < TRAVERSAL_STACK; q++) {
+                    stack[top++] = node->firstChild + q;
+                }
+                continue;
+            }
+
+            if (node->firstChild >= 0) {
+                float r2 = distanceSquared + softening;
+                float inverse = node->mass / (r2 * sqrtf(r2));
+                ax += dx * inverse;
+                ay += dy * inverse;
+                continue;
+            }
+
+            for (int k = node->start; k < node->start + node->count; k++) {
+                int j = tree->order[k];
+                if (j == i) continue;
+                const Circle* other = &circles[j];
+                float px = nearestImage(other->xPos - c->xPos, xPeriod);
+                float py = nearestImage(other->yPos - c->yPos, yPeriod);
+                float r2 = px * px + py * py + softening;
+                float inverse = other->radius * other->radius / (r2 * sqrtf(r2));
+                ax += px * inverse;
+                ay += py * inverse;
+            }
+        }
+
+        pass->xAcc[i] = pass->strength * ax;
+        pass->yAcc[i] = pass->strength * ay;
+    }
+}
+
+void QuadTree_Accelerations(const QuadTree* tree, const Circle* circles, int numCircles, float strength,
+                            float theta, float xPeriod, float yPeriod, float* xAcc, float* yAcc) {
+    AccelerationPass pass = { tree, circles, strength, theta * theta, xPeriod, yPeriod, xAcc, yAcc };
+    JobSystem_ParallelFor(numCircles, PARTICLES_PER_JOB, accelerationRange, &pass);
+}
+
+void QuadTree_Destroy(QuadTree* tree) {
+    free(tree->nodes);
+    free(tree->order);
+    for (int q = 0; q < 4; q++) {
+        free(tree->quadrantNodes[q]);
+    }
+    memset(tree, 0, sizeof(*tree));
+}
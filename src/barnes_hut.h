@@ -0,0 +1,35 @@
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+#include "circle.h"
+
+// Quadtree node, either a leaf owning a run of particle indices or an internal node with 4 children
+typedef struct {
+    float xCenter, yCenter, halfSize; // square covered by this node
+    float xMass, yMass, mass;         // centre of mass and total mass (particle area) of the subtree
+    int firstChild;                   // index of the 4 contiguous children, -1 for leaves
+    int start, count;                 // leaf particles in QuadTree.order[start .. start + count)
+} QuadNode;
+
+typedef struct {
+    QuadNode* nodes;
+    int numNodes, nodeCapacity;
+    int* order;                       // particle indices grouped by leaf
+    int orderCapacity;
+    QuadNode* quadrantNodes[4];       // build scratch of each root quadrant, kept between steps
+    int quadrantCapacity[4];
+} QuadTree;
+
+// Rebuild the tree over the particles, the four root quadrants are built as parallel jobs
+void QuadTree_Build(QuadTree* tree, const Circle* circles, int numCircles);
+
+// Pairwise 1/r^2 acceleration on every particle, strength > 0 attracts (gravity), < 0 repels (Coulomb-like).
+// Cells seen under an angle below theta are approximated by their centre of mass. A period > 0 makes
+// that axis periodic: every particle and cell acts through its nearest image, and cells reaching half
+// a period from the particle are always opened, as their particles do not share one image.
+void QuadTree_Accelerations(const QuadTree* tree, const Circle* circles, int numCircles, float strength,
+                            float theta, float xPeriod, float yPeriod, float* xAcc, float* yAcc);
+
+void QuadTree_Destroy(QuadTree* tree);
+
+#endif // BARNES_HUT_H
@@ -0,0 +1,187 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC "FCKP"
+#define WRITE_CHUNK 4096 // floats gathered per write call
+
+static int hostIsLittleEndian(void) {
+    const uint16_t probe = 1;
+    return *(const unsigned char*)&probe == 1;
+}
+
+static size_t alignOffset(size_t offset) {
+    return (offset + CHECKPOINT_ALIGNMENT - 1) & ~(size_t)(CHECKPOINT_ALIGNMENT - 1);
+}
+
+static float particleField(const Circle* c, int array) {
+    switch (array) {
+        case CHECKPOINT_X_POSITION: return c->xPos;
+        case CHECKPOINT_Y_POSITION: return c->yPos;
+        case CHECKPOINT_X_VELOCITY: return c->xVelocity;
+        case CHECKPOINT_Y_VELOCITY: return c->yVelocity;
+        default: return c->radius;
+    }
+}
+
+static int writeAll(int fd, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+static int writePadding(int fd, size_t from, size_t to) {
+    static const unsigned char zeros[CHECKPOINT_ALIGNMENT];
+    return to > from ? writeAll(fd, zeros, to - from) : 0;
+}
+
+// The rename is only durable once the directory entry itself is synced
+static void syncParentDirectory(const char* path) {
+    char directory[1024];
+    snprintf(directory, sizeof(directory), "%s", path);
+    char* slash = strrchr(directory, '/');
+    if (slash) {
+        *(slash == directory ? slash + 1 : slash) = '\0';
+    } else {
+        snprintf(directory, sizeof(directory), ".");
+    }
+    int fd = open(directory, O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+int Checkpoint_Write(const char* path, const CheckpointHeader* parameters, const Circle* circles, int numCircles) {
+    if (!hostIsLittleEndian()) {
+        fprintf(stderr, "Checkpoints are only supported on little-endian hosts\n");
+        return -1;
+    }
+
+    CheckpointHeader header = *parameters;
+    memcpy(header.magic, CHECKPOINT_MAGIC, 4);
+    header.version = CHECKPOINT_VERSION;
+    header.headerSize = sizeof(CheckpointHeader);
+    header.numCircles = numCircles;
+    header.reserved = 0;
+    size_t offset = alignOffset(sizeof(CheckpointHeader));
+    for (int k = 0; k < CHECKPOINT_NUM_ARRAYS; k++) {
+        header.arrayOffset[k] = offset;
+        offset = alignOffset(offset + sizeof(float) * (size_t)numCircles);
+    }
+
+    char temporaryPath[1024];
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path);
+    int fd = open(temporaryPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Could not write checkpoint %s\n", temporaryPath);
+        return -1;
+    }
+
+    float chunk[WRITE_CHUNK];
+    size_t position = sizeof(CheckpointHeader);
+    int ok = writeAll(fd, &header, sizeof(header)) == 0;
+    for (int k = 0; k < CHECKPOINT_NUM_ARRAYS && ok; k++) {
+        ok = writePadding(fd, position, header.arrayOffset[k]) == 0;
+        position = header.arrayOffset[k];
+        for (int begin = 0; begin < numCircles && ok; begin += WRITE_CHUNK) {
+            int count = numCircles - begin < WRITE_CHUNK ? numCircles - begin : WRITE_CHUNK;
+            for (int i = 0; i < count; i++) {
+                chunk[i] = particleField(&circles[begin + i], k);
+            }
+            ok = writeAll(fd, chunk, sizeof(float) * (size_t)count) == 0;
+            position += sizeof(float) * (size_t)count;
+        }
+    }
+    ok = ok && writePadding(fd, position, offset) == 0;
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(temporaryPath, path) != 0) {
+        fprintf(stderr, "Failed to write checkpoint %s\n", path);
+        unlink(temporaryPath);
+        return -1;
+    }
+    syncParentDirectory(path);
+    return 0;
+}
+
+int Checkpoint_Open(Checkpoint* checkpoint, const char* path) {
+    memset(checkpoint, 0, sizeof(*checkpoint));
+    if (!hostIsLittleEndian()) {
+        fprintf(stderr, "Checkpoints are only supported on little-endian hosts\n");
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not read checkpoint %s\n", path);
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CheckpointHeader)) {
+        fprintf(stderr, "Checkpoint %s is truncated\n", path);
+        close(fd);
+        return -1;
+    }
+    void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Could not map checkpoint %s\n", path);
+        return -1;
+    }
+
+    const CheckpointHeader* header = mapping;
+    int ok = memcmp(header->magic, CHECKPOINT_MAGIC, 4) == 0 &&
+             header->version == CHECKPOINT_VERSION &&
+             header->headerSize == sizeof(CheckpointHeader) &&
+             header->numCircles >= 0;
+    for (int k = 0; k < CHECKPOINT_NUM_ARRAYS && ok; k++) {
+        uint64_t offset = header->arrayOffset[k];
+        ok = offset % CHECKPOINT_ALIGNMENT == 0 &&
+             offset + sizeof(float) * (uint64_t)header->numCircles <= (uint64_t)info.st_size;
+        if (ok) checkpoint->arrays[k] = (const float*)((const unsigned char*)mapping + offset);
+    }
+    if (!ok) {
+        fprintf(stderr, "Checkpoint %s is invalid or from an incompatible version\n", path);
+        munmap(mapping, (size_t)info.st_size);
+        memset(checkpoint, 0, sizeof(*checkpoint));
+        return -1;
+    }
+
+    posix_madvise(mapping, (size_t)info.st_size, POSIX_MADV_SEQUENTIAL);
+    checkpoint->header = header;
+    checkpoint->mapping = mapping;
+    checkpoint->mappingSize = (size_t)info.st_size;
+    return 0;
+}
+
+void Checkpoint_Restore(const Checkpoint* checkpoint, Circle* circles) {
+    const float* const* a = checkpoint->arrays;
+    for (int i = 0; i < checkpoint->header->numCircles; i++) {
+        circles[i].xPos = a[CHECKPOINT_X_POSITION][i];
+        circles[i].yPos = a[CHECKPOINT_Y_POSITION][i];
+        circles[i].xVelocity = a[CHECKPOINT_X_VELOCITY][i];
+        circles[i].yVelocity = a[CHECKPOINT_Y_VELOCITY][i];
+        circles[i].radius = a[CHECKPOINT_RADIUS][i];
+    }
+}
+
+void Checkpoint_Close(Checkpoint* checkpoint) {
+    if (checkpoint->mapping) munmap(checkpoint->mapping, checkpoint->mappingSize);
+    memset(checkpoint, 0, sizeof(*checkpoint));
+}
@@ -0,0 +1,62 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "circle.h"
+
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_ALIGNMENT 64
+
+// Per-particle arrays of a checkpoint, in file order
+enum {
+    CHECKPOINT_X_POSITION,
+    CHECKPOINT_Y_POSITION,
+    CHECKPOINT_X_VELOCITY,
+    CHECKPOINT_Y_VELOCITY,
+    CHECKPOINT_RADIUS,
+    CHECKPOINT_NUM_ARRAYS
+};
+
+// Little-endian file header. It is followed by the particle arrays as floats (SoA), each one
+// starting at arrayOffset[k], a multiple of CHECKPOINT_ALIGNMENT from the start of the file.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t headerSize;
+    int32_t numCircles;
+    uint64_t step;
+    uint64_t rngState;          // seed of the counter-based RNG, together with step its whole state
+    float timestep;
+    int32_t timestepLevels;
+    int32_t periodicX, periodicY;
+    int32_t longRangeMode;
+    float longRangeStrength, longRangeTheta;
+    float gravity, restitution;
+    float forcingAmplitude;
+    uint32_t reserved;
+    uint64_t arrayOffset[CHECKPOINT_NUM_ARRAYS];
+} CheckpointHeader;
+
+// A checkpoint file mapped read-only, the arrays point straight into the mapping
+typedef struct {
+    const CheckpointHeader* header;
+    const float* arrays[CHECKPOINT_NUM_ARRAYS];
+    void* mapping;
+    size_t mappingSize;
+} Checkpoint;
+
+// Write the particles to path through a temporary file that is synced and renamed over it,
+// so path always holds either the previous or the new complete checkpoint. The caller fills
+// the parameter fields of header, the rest is set here.
+int Checkpoint_Write(const char* path, const CheckpointHeader* header, const Circle* circles, int numCircles);
+
+// Map a checkpoint and validate its header and size, nothing is parsed or copied
+int Checkpoint_Open(Checkpoint* checkpoint, const char* path);
+
+// Scatter the mapped arrays into circles, which must hold header->numCircles entries
+void Checkpoint_Restore(const Checkpoint* checkpoint, Circle* circles);
+
+void Checkpoint_Close(Checkpoint* checkpoint);
+
+#endif // CHECKPOINT_H
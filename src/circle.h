@@ -1,14 +1,13 @@
 #ifndef CIRCLE_H
 #define CIRCLE_H
 
+// Simulation state only, the GL objects that draw particles belong to the renderers in render.h
 typedef struct {
     float xPos;
     float yPos;
     float xVelocity;
     float yVelocity;
     float radius;
-    unsigned int VAO; // Vertex Array Object
-    unsigned int VBO; // Vertex Buffer Object
 } Circle;
 
 #endif // CIRCLE_H
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ensemble.h"
+#include "physics.h"
+#include "jobs.h"
+#include "rng.h"
+
+#define ENSEMBLE_ALIGNMENT 64
+#define INSTANCES_PER_BLOCK 16 // instances per job work unit, a multiple of the SIMD width
+#define WINDOW_BOTTOM -1.0f
+#define WINDOW_TOP 1.0f
+#define WINDOW_LEFT -1.0f
+#define WINDOW_RIGHT 1.0f
+
+typedef struct {
+    Ensemble* ensemble;
+    int steps;
+} EnsembleRun;
+
+static float* allocateLanes(size_t count) {
+    size_t bytes = (sizeof(float) * count + ENSEMBLE_ALIGNMENT - 1) / ENSEMBLE_ALIGNMENT * ENSEMBLE_ALIGNMENT;
+    float* data = aligned_alloc(ENSEMBLE_ALIGNMENT, bytes);
+    if (data) memset(data, 0, bytes);
+    return data;
+}
+
+int Ensemble_Init(Ensemble* ensemble, int numInstances, int numParticles) {
+    memset(ensemble, 0, sizeof(*ensemble));
+    ensemble->numInstances = numInstances;
+    ensemble->numParticles = numParticles;
+
+    size_t count = (size_t)numInstances * numParticles;
+    ensemble->xPos = allocateLanes(count);
+    ensemble->yPos = allocateLanes(count);
+    ensemble->xVelocity = allocateLanes(count);
+    ensemble->yVelocity = allocateLanes(count);
+    ensemble->radius = allocateLanes(count);
+    ensemble->gravity = allocateLanes(numInstances);
+    ensemble->restitution = allocateLanes(numInstances);
+    ensemble->timestep = allocateLanes(numInstances);
+    if (!ensemble->xPos || !ensemble->yPos || !ensemble->xVelocity || !ensemble->yVelocity ||
+        !ensemble->radius || !ensemble->gravity || !ensemble->restitution || !ensemble->timestep) {
+        fprintf(stderr, "Failed to allocate memory for ensemble\n");
+        Ensemble_Destroy(ensemble);
+        return -1;
+    }
+
+    for (int w = 0; w < numInstances; w++) {
+        Ensemble_SetParameters(ensemble, w, 1.0f, 0.96f, 0.05f);
+    }
+    return 0;
+}
+
+void Ensemble_SetParameters(Ensemble* ensemble, int instance, float gravity, float restitution, float timestep) {
+    ensemble->gravity[instance] = gravity;
+    ensemble->restitution[instance] = restitution;
+    ensemble->timestep[instance] = timestep;
+}
+
+void Ensemble_FillGrid(Ensemble* ensemble, int gridLength, float spacing, float radius, unsigned int seed) {
+    int m = ensemble->numInstances;
+    for (int w = 0; w < m; w++) {
+        uint64_t instanceSeed = ((uint64_t)(w + 1) << 32) ^ seed; // own key per instance
+        for (int p = 0; p < ensemble->numParticles; p++) {
+            size_t k = (size_t)p * m + w;
+            latticePosition(p, ensemble->numParticles, gridLength, spacing, &ensemble->xPos[k], &ensemble->yPos[k]);
+            ensemble->radius[k] = radius;
+            ensemble->xVelocity[k] = 0.5f * Rng_Uniform(instanceSeed, RNG_STREAM_VELOCITY_X, (uint64_t)p, 0);
+            ensemble->yVelocity[k] = 0.01f * Rng_Uniform(instanceSeed, RNG_STREAM_VELOCITY_Y, (uint64_t)p, 0);
+        }
+    }
+}
+
+// Baseline explicit Euler step with wall reflection for one particle slot across instances [w0, w1)
+static void integrateLanes(Ensemble* e, int p, int w0, int w1) {
+    int m = e->numInstances;
+    float* restrict x = e->xPos + (size_t)p * m;
+    float* restrict y = e->yPos + (size_t)p * m;
+    float* restrict vx = e->xVelocity + (size_t)p * m;
+    float* restrict vy = e->yVelocity + (size_t)p * m;
+    const float* restrict gravity = e->gravity;
+    const float* restrict timestep = e->timestep;
+
+    // Every select below is a blend, so the loop vectorises at -O2 (see -fopt-info-vec)
+    #pragma omp simd
+    for (int w = w0; w < w1; w++) {
+        float dt = timestep[w];
+        float px = x[w] + vx[w] * dt;
+        float py = y[w] + vy[w] * dt;
+        float velX = vx[w];
+        float velY = vy[w] - gravity[w] * dt;
+
+        // Wall reflection as selects on bitwise masks, so the lane loop has no branches
+        int wallY = (py <= WINDOW_BOTTOM) | (py >= WINDOW_TOP);
+        int wallX = (px <= WINDOW_LEFT) | (px >= WINDOW_RIGHT);
+        velY = wallY ? -velY : velY;
+        velX = wallX ? -velX : velX;
+        px = px < WINDOW_LEFT ? WINDOW_LEFT : px;
+        py = py < WINDOW_BOTTOM ? WINDOW_BOTTOM : py;
+        x[w] = px > WINDOW_RIGHT ? WINDOW_RIGHT : px;
+        y[w] = py > WINDOW_TOP ? WINDOW_TOP : py;
+        vx[w] = velX;
+        vy[w] = velY;
+    }
+}
+
+// Baseline pairwise contact for (i, j) in every instance, masked per lane: both particles are
+// pushed apart and bounced at once, in sequential pair order
+static void collideLanes(Ensemble* e, int i, int j, int w0, int w1) {
+    int m = e->numInstances;
+    float* restrict x1 = e->xPos + (size_t)i * m;
+    float* restrict y1 = e->yPos + (size_t)i * m;
+    float* restrict vx1 = e->xVelocity + (size_t)i * m;
+    float* restrict vy1 = e->yVelocity + (size_t)i * m;
+    const float* restrict r1 = e->radius + (size_t)i * m;
+    float* restrict x2 = e->xPos + (size_t)j * m;
+    float* restrict y2 = e->yPos + (size_t)j * m;
+    float* restrict vx2 = e->xVelocity + (size_t)j * m;
+    float* restrict vy2 = e->yVelocity + (size_t)j * m;
+    const float* restrict r2 = e->radius + (size_t)j * m;
+    const float* restrict restitution = e->restitution;
+
+    #pragma omp simd
+    for (int w = w0; w < w1; w++) {
+        float dx = x2[w] - x1[w];
+        float dy = y2[w] - y1[w];
+        float distanceSquared = dx * dx + dy * dy;
+        float radiusSum = r1[w] + r2[w];
+        int contact = (distanceSquared < radiusSum * radiusSum) & (distanceSquared > 0.0f);
+        float hit = contact ? 1.0f : 0.0f;
+
+        float distance = sqrtf(distanceSquared > 1e-30f ? distanceSquared : 1e-30f);
+        float nx = dx / distance;
+        float ny = dy / distance;
+        float halfOverlap = hit * 0.5f * (radiusSum - distance);
+        x1[w] -= nx * halfOverlap;
+        y1[w] -= ny * halfOverlap;
+        x2[w] += nx * halfOverlap;
+        y2[w] += ny * halfOverlap;
+
+        float bounce = hit * (1.0f + restitution[w]);
+        float dot1 = bounce * (vx1[w] * nx + vy1[w] * ny);
+        float dot2 = bounce * (vx2[w] * nx + vy2[w] * ny);
+        vx1[w] -= dot1 * nx;
+        vy1[w] -= dot1 * ny;
+        vx2[w] -= dot2 * nx;
+        vy2[w] -= dot2 * ny;
+    }
+}
+
+static void stepRange(Ensemble* e, int w0, int w1, int steps) {
+    int n = e->numParticles;
+    for (int s = 0; s < steps; s++) {
+        for (int p = 0; p < n; p++) {
+            integrateLanes(e, p, w0, w1);
+        }
+        for (int i = 0; i < n; i++) {
+            for (int j = i + 1; j < n; j++) {
+                collideLanes(e, i, j, w0, w1);
+            }
+        }
+    }
+}
+
+// Instances never interact, so each job runs its blocks of instances for all steps
+static void stepBlocks(int firstBlock, int lastBlock, void* context) {
+    EnsembleRun* run = context;
+    int lastInstance = lastBlock * INSTANCES_PER_BLOCK;
+    if (lastInstance > run->ensemble->numInstances) lastInstance = run->ensemble->numInstances;
+    stepRange(run->ensemble, firstBlock * INSTANCES_PER_BLOCK, lastInstance, run->steps);
+}
+
+void Ensemble_Step(Ensemble* ensemble, int steps) {
+    int blocks = (ensemble->numInstances + INSTANCES_PER_BLOCK - 1) / INSTANCES_PER_BLOCK;
+    EnsembleRun run = { ensemble, steps };
+    JobSystem_ParallelFor(blocks, 1, stepBlocks, &run);
+}
+
+float Ensemble_KineticEnergy(const Ensemble* ensemble, int instance) {
+    int m = ensemble->numInstances;
+    double energy = 0.0;
+    for (int p = 0; p < ensemble->numParticles; p++) {
+        size_t k = (size_t)p * m + instance;
+        energy += 0.5 * (ensemble->xVelocity[k] * ensemble->xVelocity[k] +
+                         ensemble->yVelocity[k] * ensemble->yVelocity[k]);
+    }
+    return ensemble->numParticles > 0 ? (float)(energy / ensemble->numParticles) : 0.0f;
+}
+
+void Ensemble_Destroy(Ensemble* ensemble) {
+    free(ensemble->xPos);
+    free(ensemble->yPos);
+    free(ensemble->xVelocity);
+    free(ensemble->yVelocity);
+    free(ensemble->radius);
+    free(ensemble->gravity);
+    free(ensemble->restitution);
+    free(ensemble->timestep);
+    memset(ensemble, 0, sizeof(*ensemble));
+}
@@ -0,0 +1,38 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+// Many small independent worlds stepped together. Arrays are particle-major and
+// instance-minor: particle p of instance w lives at [p * numInstances + w], so the
+// inner loops run across instances and vectorise, and jobs take blocks of instances.
+// Each instance runs the baseline model: an O(n^2) sequential loop over particle pairs, with
+// explicit Euler steps and wall reflection. It diverges from physics.c, which has a grid
+// broadphase, snapshot (Jacobi) contacts, domain confinement, boundary SDFs, periodic axes,
+// multi-rate steps and forcing, so ensemble results are not those of the library's solver.
+typedef struct {
+    int numInstances;
+    int numParticles;                 // per instance
+    float *xPos, *yPos;
+    float *xVelocity, *yVelocity;
+    float *radius;
+    float *gravity;                   // per instance
+    float *restitution;               // per instance, 0.96 matches the interactive simulation
+    float *timestep;                  // per instance
+} Ensemble;
+
+// Allocate an ensemble with default parameters, returns 0 on success
+int Ensemble_Init(Ensemble* ensemble, int numInstances, int numParticles);
+
+void Ensemble_SetParameters(Ensemble* ensemble, int instance, float gravity, float restitution, float timestep);
+
+// Lay out every instance on the default lattice (see latticePosition) with per-instance random velocities
+void Ensemble_FillGrid(Ensemble* ensemble, int gridLength, float spacing, float radius, unsigned int seed);
+
+// Advance every instance by the given number of steps
+void Ensemble_Step(Ensemble* ensemble, int steps);
+
+// Mean kinetic energy per particle of one instance
+float Ensemble_KineticEnergy(const Ensemble* ensemble, int instance);
+
+void Ensemble_Destroy(Ensemble* ensemble);
+
+#endif // ENSEMBLE_H
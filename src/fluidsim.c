@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "fluidsim.h"
+#include "physics.h"
+#include "scene.h"
+#include "sdf.h"
+#include "checkpoint.h"
+#include "jobs.h"
+#include "rng.h"
+
+#define DEFAULT_PARTICLES 1000
+#define DEFAULT_TIMESTEP 0.05f
+#define SDF_RESOLUTION 256
+#define GRID_LENGTH 100          // default lattice: columns, spacing and radius
+#define GRID_SPACING 0.004f
+#define GRID_RADIUS 0.007f
+
+struct FluidWorld {
+    Circle* circles;
+    int numCircles;
+    float timestep;
+    long long step;
+    Scene scene;
+    bool hasScene;
+    SDFGrid boundary;          // from boundaryPath
+    bool hasBoundary;
+    bool ownsJobSystem;
+};
+
+static bool worldExists = false;
+
+static const size_t fieldOffsets[FLUID_NUM_FIELDS] = {
+    offsetof(Circle, xPos), offsetof(Circle, yPos), offsetof(Circle, xVelocity), offsetof(Circle, yVelocity),
+    offsetof(Circle, radius)
+};
+
+typedef struct {
+    Circle* circles;
+    int numCircles;
+    uint64_t seed;
+} LatticeContext;
+
+// Rows of GRID_LENGTH particles going up from y = 0 while they fit the domain, with random
+// rightward velocities
+static void latticeRange(int begin, int end, void* context) {
+    const LatticeContext* lattice = context;
+    for (int i = begin; i < end; i++) {
+        Circle* c = &lattice->circles[i];
+        latticePosition(i, lattice->numCircles, GRID_LENGTH, GRID_SPACING, &c->xPos, &c->yPos);
+        c->radius = GRID_RADIUS;
+        c->xVelocity = 0.5f * Rng_Uniform(lattice->seed, RNG_STREAM_VELOCITY_X, (uint64_t)i, 0);
+        c->yVelocity = 0.01f * Rng_Uniform(lattice->seed, RNG_STREAM_VELOCITY_Y, (uint64_t)i, 0);
+    }
+}
+
+FluidWorld* FluidWorld_Create(const FluidWorldDesc* desc) {
+    if (worldExists) {
+        fprintf(stderr, "Only one fluid world can exist at a time\n");
+        return NULL;
+    }
+    FluidWorld* world = calloc(1, sizeof(FluidWorld));
+    if (!world) {
+        fprintf(stderr, "Failed to allocate memory for fluid world\n");
+        return NULL;
+    }
+    world->ownsJobSystem = !JobSystem_IsRunning();
+    JobSystem_Init(desc->numThreads);
+    world->timestep = DEFAULT_TIMESTEP;
+    world->numCircles = desc->numParticles > 0 ? desc->numParticles : DEFAULT_PARTICLES;
+    worldExists = true;
+
+    // The scene starts from the current settings and overrides those it names
+    if (desc->scenePath) {
+        if (Scene_Load(&world->scene, desc->scenePath, SDF_RESOLUTION) != 0) {
+            FluidWorld_Destroy(world);
+            return NULL;
+        }
+        world->hasScene = true;
+        world->numCircles = world->scene.numCircles;
+        const PhysicsParameters* parameters = &world->scene.parameters;
+        setPeriodicBoundaries(parameters->periodicX, parameters->periodicY);
+        setGravity(parameters->gravity);
+        setRestitution(parameters->restitution);
+        setTimestepBins(parameters->timestepLevels);
+        setRandomSeed(parameters->seed);
+        setRandomForcing(parameters->forcingAmplitude);
+        if (world->scene.timestep > 0.0f) world->timestep = world->scene.timestep;
+        if (world->scene.hasBoundary) setBoundarySDF(&world->scene.boundary);
+    }
+    if (desc->boundaryPath) {
+        if (SDFGrid_LoadScene(&world->boundary, desc->boundaryPath, SDF_RESOLUTION) != 0) {
+            FluidWorld_Destroy(world);
+            return NULL;
+        }
+        world->hasBoundary = true;
+        setBoundarySDF(&world->boundary);
+    }
+
+    world->circles = allocateCircles(world->numCircles);
+    if (!world->circles) {
+        FluidWorld_Destroy(world);
+        return NULL;
+    }
+    if (world->hasScene) {
+        Scene_Generate(&world->scene, world->circles);
+    } else {
+        PhysicsParameters parameters;
+        getPhysicsParameters(&parameters);
+        LatticeContext lattice = { world->circles, world->numCircles, parameters.seed };
+        JobSystem_ParallelFor(world->numCircles, 4096, latticeRange, &lattice);
+    }
+    setStepIndex(0);
+    return world;
+}
+
+void FluidWorld_Step(FluidWorld* world, int steps) {
+    for (int s = 0; s < steps; s++) {
+        updatePosition(world->circles, FluidWorld_ActiveCount(world), world->timestep);
+        world->step++;
+    }
+}
+
+void FluidWorld_GetParameters(const FluidWorld* world, FluidParameters* parameters) {
+    PhysicsParameters physics;
+    getPhysicsParameters(&physics);
+    memset(parameters, 0, sizeof(*parameters));
+    parameters->seed = physics.seed;
+    parameters->timestep = world->timestep;
+    parameters->gravity = physics.gravity;
+    parameters->restitution = physics.restitution;
+    parameters->forcingAmplitude = physics.forcingAmplitude;
+    parameters->periodicX = physics.periodicX;
+    parameters->periodicY = physics.periodicY;
+    parameters->timestepLevels = physics.timestepLevels;
+    parameters->longRangeMode = physics.longRangeMode;
+    parameters->longRangeStrength = physics.longRangeStrength;
+    parameters->longRangeTheta = physics.longRangeTheta;
+}
+
+void FluidWorld_SetParameters(FluidWorld* world, const FluidParameters* parameters) {
+    world->timestep = parameters->timestep;
+    setRandomSeed(parameters->seed);
+    setGravity(parameters->gravity);
+    setRestitution(parameters->restitution);
+    setRandomForcing(parameters->forcingAmplitude);
+    setPeriodicBoundaries(parameters->periodicX != 0, parameters->periodicY != 0);
+    setTimestepBins(parameters->timestepLevels);
+    setLongRangeForce((LongRangeMode)parameters->longRangeMode, parameters->longRangeStrength,
+                      parameters->longRangeTheta);
+}
+
+int FluidWorld_Capacity(const FluidWorld* world) {
+    return world->numCircles;
+}
+
+int FluidWorld_ActiveCount(const FluidWorld* world) {
+    return world->hasScene ? Scene_ActiveCount(&world->scene, world->step) : world->numCircles;
+}
+
+long long FluidWorld_StepIndex(const FluidWorld* world) {
+    return world->step;
+}
+
+float* FluidWorld_Field(FluidWorld* world, FluidField field, size_t* stride) {
+    if (stride) *stride = sizeof(Circle);
+    if ((int)field < 0 || field >= FLUID_NUM_FIELDS) return NULL;
+    return (float*)((char*)world->circles + fieldOffsets[field]);
+}
+
+Circle* FluidWorld_Circles(FluidWorld* world) {
+    return world->circles;
+}
+
+void FluidWorld_DensityPressure(FluidWorld* world, float* density, float* pressure) {
+    computeDensityPressure(world->circles, FluidWorld_ActiveCount(world), density, pressure);
+}
+
+int FluidWorld_SaveCheckpoint(const FluidWorld* world, const char* path) {
+    FluidParameters parameters;
+    FluidWorld_GetParameters(world, &parameters);
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    header.step = (uint64_t)world->step;
+    header.rngState = parameters.seed;
+    header.timestep = parameters.timestep;
+    header.timestepLevels = parameters.timestepLevels;
+    header.periodicX = parameters.periodicX;
+    header.periodicY = parameters.periodicY;
+    header.longRangeMode = parameters.longRangeMode;
+    header.longRangeStrength = parameters.longRangeStrength;
+    header.longRangeTheta = parameters.longRangeTheta;
+    header.gravity = parameters.gravity;
+    header.restitution = parameters.restitution;
+    header.forcingAmplitude = parameters.forcingAmplitude;
+    return Checkpoint_Write(path, &header, world->circles, world->numCircles);
+}
+
+int FluidWorld_LoadCheckpoint(FluidWorld* world, const char* path) {
+    Checkpoint checkpoint;
+    if (Checkpoint_Open(&checkpoint, path) != 0) {
+        return -1;
+    }
+    const CheckpointHeader* header = checkpoint.header;
+    if (header->numCircles != world->numCircles) {
+        fprintf(stderr, "Checkpoint %s holds %d particles, expected %d\n", path, header->numCircles, world->numCircles);
+        Checkpoint_Close(&checkpoint);
+        return -1;
+    }
+    Checkpoint_Restore(&checkpoint, world->circles);
+    FluidParameters parameters = {
+        .seed = header->rngState,
+        .timestep = header->timestep,
+        .gravity = header->gravity,
+        .restitution = header->restitution,
+        .forcingAmplitude = header->forcingAmplitude,
+        .periodicX = header->periodicX,
+        .periodicY = header->periodicY,
+        .timestepLevels = header->timestepLevels,
+        .longRangeMode = header->longRangeMode,
+        .longRangeStrength = header->longRangeStrength,
+        .longRangeTheta = header->longRangeTheta
+    };
+    FluidWorld_SetParameters(world, &parameters);
+    world->step = (long long)header->step;
+    setStepIndex(header->step);
+    Checkpoint_Close(&checkpoint);
+    return 0;
+}
+
+uint64_t FluidWorld_StateHash(const FluidWorld* world) {
+    return hashCircles(world->circles, world->numCircles);
+}
+
+void FluidWorld_Destroy(FluidWorld* world) {
+    if (!world) return;
+    resetPhysicsParameters(); // the settings are module state, the next world starts from defaults
+    if (world->circles) freeCircles(world->circles, world->numCircles);
+    if (world->hasScene) Scene_Destroy(&world->scene);
+    if (world->hasBoundary) SDFGrid_Destroy(&world->boundary);
+    if (world->ownsJobSystem) JobSystem_Shutdown();
+    free(world);
+    worldExists = false;
+}
@@ -0,0 +1,88 @@
+#ifndef FLUIDSIM_H
+#define FLUIDSIM_H
+
+// Public interface of libfluidsim, the simulation core without any windowing or GL dependency.
+// A world owns the particles, the solver settings and the step counter; everything else in the
+// library is an implementation detail. Callers build against this header and circle.h only.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "circle.h"
+
+#define FLUIDSIM_API_VERSION 1
+
+// The library is built with hidden visibility, only these functions are exported
+#define FLUIDSIM_API __attribute__((visibility("default")))
+
+typedef struct FluidWorld FluidWorld;
+
+typedef struct {
+    int numParticles;          // size of the default lattice, ignored when scenePath is set
+    const char* scenePath;     // scene file to generate the particles from, NULL for the default lattice
+    const char* boundaryPath;  // .poly boundary, replaces the polygons of the scene
+    int numThreads;            // job system threads, <= 0 for one per core
+} FluidWorldDesc;
+
+// Solver settings with fixed-size fields, so bindings can mirror the layout
+typedef struct {
+    uint64_t seed;             // counter-based RNG seed
+    float timestep;
+    float gravity;
+    float restitution;
+    float forcingAmplitude;
+    int32_t periodicX, periodicY;
+    int32_t timestepLevels;
+    int32_t longRangeMode;     // 0 none, 1 gravity, 2 Coulomb
+    float longRangeStrength;
+    float longRangeTheta;
+} FluidParameters;
+
+// Per-particle values, each one a strided view into the particle records
+typedef enum {
+    FLUID_X_POSITION,
+    FLUID_Y_POSITION,
+    FLUID_X_VELOCITY,
+    FLUID_Y_VELOCITY,
+    FLUID_RADIUS,
+    FLUID_NUM_FIELDS
+} FluidField;
+
+// The solver keeps its settings in module state, so only one world can exist at a time.
+// Returns NULL on failure (including when a world already exists).
+FLUIDSIM_API FluidWorld* FluidWorld_Create(const FluidWorldDesc* desc);
+
+FLUIDSIM_API void FluidWorld_Step(FluidWorld* world, int steps);
+
+FLUIDSIM_API void FluidWorld_GetParameters(const FluidWorld* world, FluidParameters* parameters);
+FLUIDSIM_API void FluidWorld_SetParameters(FluidWorld* world, const FluidParameters* parameters);
+
+// All particles the world holds, including emitted ones that are not released yet
+FLUIDSIM_API int FluidWorld_Capacity(const FluidWorld* world);
+
+// Particles the next step advances, always a prefix of the records
+FLUIDSIM_API int FluidWorld_ActiveCount(const FluidWorld* world);
+
+FLUIDSIM_API long long FluidWorld_StepIndex(const FluidWorld* world);
+
+// Zero-copy access: value i of the field is at (float*)((char*)base + i * stride). The pointer
+// stays valid for the life of the world; writes take effect from the next step.
+FLUIDSIM_API float* FluidWorld_Field(FluidWorld* world, FluidField field, size_t* stride);
+
+// The particle records the fields point into, for in-tree tools that take circle.h arrays
+FLUIDSIM_API Circle* FluidWorld_Circles(FluidWorld* world);
+
+// Derived density and pressure of the active particles, see computeDensityPressure
+FLUIDSIM_API void FluidWorld_DensityPressure(FluidWorld* world, float* density, float* pressure);
+
+FLUIDSIM_API int FluidWorld_SaveCheckpoint(const FluidWorld* world, const char* path);
+
+// Replace the particles, settings and step counter with those of a checkpoint of the same size
+FLUIDSIM_API int FluidWorld_LoadCheckpoint(FluidWorld* world, const char* path);
+
+// FNV-1a over the positions and velocities, equal for bit-identical states
+FLUIDSIM_API uint64_t FluidWorld_StateHash(const FluidWorld* world);
+
+// Free the world and put every solver setting back to its default for the next one
+FLUIDSIM_API void FluidWorld_Destroy(FluidWorld* world);
+
+#endif // FLUIDSIM_H
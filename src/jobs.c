@@ -0,0 +1,346 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "jobs.h"
+
+#define MAX_JOB_THREADS 256
+#define DEQUE_CAPACITY 4096     // power of two
+#define JOB_POOL_SIZE 4096      // jobs per thread, finished ones recycled round-robin
+#define INJECT_CAPACITY 1024    // jobs queued by threads outside the pool
+#define MAX_CONTINUATIONS 4
+#define SPINS_BEFORE_SLEEP 64
+#define PARALLEL_FOR_SPLITS 4   // target ranges per thread
+
+struct Job {
+    JobFunction function;
+    Job* parent;
+    atomic_int unfinished;      // 1 for the job itself plus one per unfinished child
+    int numContinuations;
+    Job* continuations[MAX_CONTINUATIONS];
+    _Alignas(16) unsigned char data[JOB_DATA_SIZE];
+};
+
+// Chase-Lev deque: the owner pushes and pops at the bottom, thieves take from the top
+typedef struct {
+    _Alignas(64) atomic_long top;      // own cache lines, also keeps sizeof a multiple of 64 for aligned_alloc
+    _Alignas(64) atomic_long bottom;
+    _Alignas(64) Job* _Atomic buffer[DEQUE_CAPACITY];
+} JobDeque;
+
+typedef struct {
+    ParallelForFunction function;
+    void* context;
+    int begin, end, grain;
+} ParallelForRange;
+
+static JobDeque* deques[MAX_JOB_THREADS];
+static pthread_t workers[MAX_JOB_THREADS];
+static int numThreads = 0;
+static atomic_bool running;
+
+// Threads that are not part of the pool queue their jobs here
+static Job* injected[INJECT_CAPACITY];
+static atomic_int injectedCount;
+static pthread_mutex_t injectLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Idle workers sleep until a job is queued
+static atomic_int queuedJobs;
+static atomic_int sleepers;
+static pthread_mutex_t sleepLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sleepCondition = PTHREAD_COND_INITIALIZER;
+
+static _Thread_local int threadIndex = -1; // -1 for threads outside the pool
+static _Thread_local Job* jobPool = NULL;
+static _Thread_local unsigned int jobPoolNext = 0;
+static _Thread_local unsigned int stealSeed = 0;
+
+static bool dequePush(JobDeque* deque, Job* job) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= DEQUE_CAPACITY) return false;
+    atomic_store_explicit(&deque->buffer[bottom & (DEQUE_CAPACITY - 1)], job, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return true;
+}
+
+static Job* dequePop(JobDeque* deque) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return NULL;
+    }
+    Job* job = atomic_load_explicit(&deque->buffer[bottom & (DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (top == bottom) {
+        // Last entry, race any thief for it
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                     memory_order_seq_cst, memory_order_relaxed)) {
+            job = NULL;
+        }
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    }
+    return job;
+}
+
+static Job* dequeSteal(JobDeque* deque) {
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) return NULL;
+
+    Job* job = atomic_load_explicit(&deque->buffer[top & (DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return job;
+}
+
+static Job* takeInjected(void) {
+    Job* job = NULL;
+    pthread_mutex_lock(&injectLock);
+    if (injectedCount > 0) {
+        job = injected[0];
+        memmove(injected, injected + 1, sizeof(Job*) * (atomic_fetch_sub(&injectedCount, 1) - 1));
+    }
+    pthread_mutex_unlock(&injectLock);
+    return job;
+}
+
+// Own deque first, then jobs from outside the pool, then steal from a random victim onwards
+static Job* findJob(void) {
+    Job* job = threadIndex >= 0 ? dequePop(deques[threadIndex]) : NULL;
+    if (!job && atomic_load(&injectedCount) > 0) job = takeInjected();
+    if (!job && numThreads > 0) {
+        stealSeed = stealSeed * 1103515245u + 12345u;
+        int start = (int)((stealSeed >> 16) % (unsigned int)numThreads);
+        for (int k = 0; k < numThreads && !job; k++) {
+            int victim = (start + k) % numThreads;
+            if (victim != threadIndex) job = dequeSteal(deques[victim]);
+        }
+    }
+    if (job) atomic_fetch_sub(&queuedJobs, 1);
+    return job;
+}
+
+static void finishJob(Job* job) {
+    // Read the links first, the creating thread may reuse the slot once unfinished reaches 0
+    Job* parent = job->parent;
+    int numContinuations = job->numContinuations;
+    Job* continuations[MAX_CONTINUATIONS];
+    memcpy(continuations, job->continuations, sizeof(Job*) * (size_t)numContinuations);
+    if (atomic_fetch_sub(&job->unfinished, 1) != 1) return;
+    if (parent) finishJob(parent);
+    for (int c = 0; c < numContinuations; c++) {
+        Job_Run(continuations[c]);
+    }
+}
+
+static void executeJob(Job* job) {
+    job->function(job, job->data);
+    finishJob(job);
+}
+
+static void* workerThread(void* arg) {
+    threadIndex = (int)(size_t)arg;
+    stealSeed = (unsigned int)threadIndex * 2654435761u;
+    int idleSpins = 0;
+
+    while (atomic_load(&running)) {
+        Job* job = findJob();
+        if (job) {
+            executeJob(job);
+            idleSpins = 0;
+            continue;
+        }
+        if (++idleSpins < SPINS_BEFORE_SLEEP) {
+            sched_yield();
+            continue;
+        }
+        pthread_mutex_lock(&sleepLock);
+        atomic_fetch_add(&sleepers, 1);
+        while (atomic_load(&queuedJobs) == 0 && atomic_load(&running)) {
+            pthread_cond_wait(&sleepCondition, &sleepLock);
+        }
+        atomic_fetch_sub(&sleepers, 1);
+        pthread_mutex_unlock(&sleepLock);
+        idleSpins = 0;
+    }
+
+    free(jobPool);
+    jobPool = NULL;
+    return NULL;
+}
+
+void JobSystem_Init(int numWorkers) {
+    if (numThreads > 0) return;
+    if (numWorkers <= 0) numWorkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (numWorkers < 1) numWorkers = 1;
+    if (numWorkers > MAX_JOB_THREADS) numWorkers = MAX_JOB_THREADS;
+
+    for (int t = 0; t < numWorkers; t++) {
+        deques[t] = aligned_alloc(64, sizeof(JobDeque));
+        if (!deques[t]) {
+            fprintf(stderr, "Failed to allocate memory for job deques\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(deques[t], 0, sizeof(JobDeque));
+    }
+    atomic_store(&running, true);
+    threadIndex = 0; // the caller is worker 0
+    numThreads = numWorkers;
+    for (int t = 1; t < numWorkers; t++) {
+        if (pthread_create(&workers[t], NULL, workerThread, (void*)(size_t)t) != 0) {
+            fprintf(stderr, "Failed to start job worker %d\n", t);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+void JobSystem_Shutdown(void) {
+    if (numThreads == 0) return;
+    atomic_store(&running, false);
+    pthread_mutex_lock(&sleepLock);
+    pthread_cond_broadcast(&sleepCondition);
+    pthread_mutex_unlock(&sleepLock);
+    for (int t = 1; t < numThreads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    for (int t = 0; t < numThreads; t++) {
+        free(deques[t]);
+        deques[t] = NULL;
+    }
+    numThreads = 0;
+    threadIndex = -1;
+}
+
+int JobSystem_ThreadCount(void) {
+    return numThreads > 0 ? numThreads : 1;
+}
+
+int JobSystem_IsRunning(void) {
+    return numThreads > 0;
+}
+
+Job* Job_Create(JobFunction function, const void* data, size_t size, Job* parent) {
+    if (size > JOB_DATA_SIZE) {
+        fprintf(stderr, "Job payload of %zu bytes exceeds %d\n", size, JOB_DATA_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    if (!jobPool) {
+        jobPool = aligned_alloc(64, sizeof(Job) * JOB_POOL_SIZE);
+        if (!jobPool) {
+            fprintf(stderr, "Failed to allocate memory for jobs\n");
+            exit(EXIT_FAILURE);
+        }
+        memset(jobPool, 0, sizeof(Job) * JOB_POOL_SIZE); // every slot starts finished
+    }
+
+    // Next slot whose job has finished, a pending one (queued, waiting for children or for the
+    // job it continues) must not be overwritten
+    Job* job = NULL;
+    for (int k = 0; k < JOB_POOL_SIZE && !job; k++) {
+        Job* candidate = &jobPool[jobPoolNext++ & (JOB_POOL_SIZE - 1)];
+        if (atomic_load_explicit(&candidate->unfinished, memory_order_acquire) == 0) job = candidate;
+    }
+    if (!job) {
+        fprintf(stderr, "All %d jobs of this thread are pending\n", JOB_POOL_SIZE);
+        exit(EXIT_FAILURE);
+    }
+    job->function = function;
+    job->parent = parent;
+    job->numContinuations = 0;
+    atomic_store(&job->unfinished, 1);
+    if (size > 0) memcpy(job->data, data, size);
+    if (parent) atomic_fetch_add(&parent->unfinished, 1);
+    return job;
+}
+
+void Job_AddContinuation(Job* job, Job* continuation) {
+    if (job->numContinuations == MAX_CONTINUATIONS) {
+        fprintf(stderr, "Job has more than %d continuations\n", MAX_CONTINUATIONS);
+        exit(EXIT_FAILURE);
+    }
+    job->continuations[job->numContinuations++] = continuation;
+}
+
+void Job_Run(Job* job) {
+    // Counted before it becomes visible so sleepers never miss it
+    atomic_fetch_add(&queuedJobs, 1);
+    bool queued = false;
+    if (numThreads > 0) {
+        if (threadIndex >= 0) {
+            queued = dequePush(deques[threadIndex], job);
+        } else {
+            pthread_mutex_lock(&injectLock);
+            if (injectedCount < INJECT_CAPACITY) {
+                injected[atomic_fetch_add(&injectedCount, 1)] = job;
+                queued = true;
+            }
+            pthread_mutex_unlock(&injectLock);
+        }
+    }
+    if (!queued) {
+        // No pool or queue full: run it right here
+        atomic_fetch_sub(&queuedJobs, 1);
+        executeJob(job);
+        return;
+    }
+
+    if (atomic_load(&sleepers) > 0) {
+        pthread_mutex_lock(&sleepLock);
+        pthread_cond_signal(&sleepCondition);
+        pthread_mutex_unlock(&sleepLock);
+    }
+}
+
+void Job_Wait(const Job* job) {
+    while (atomic_load(&((Job*)job)->unfinished) > 0) {
+        Job* next = findJob();
+        if (next) {
+            executeJob(next);
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+static void parallelForJob(Job* job, void* data) {
+    ParallelForRange range = *(ParallelForRange*)data;
+    // Hand off the upper half until the range is small enough, thieves take the biggest pieces
+    while (range.end - range.begin > range.grain) {
+        int middle = range.begin + (range.end - range.begin) / 2;
+        ParallelForRange upper = range;
+        upper.begin = middle;
+        Job_Run(Job_Create(parallelForJob, &upper, sizeof(upper), job));
+        range.end = middle;
+    }
+    range.function(range.begin, range.end, range.context);
+}
+
+void JobSystem_ParallelFor(int count, int minGrain, ParallelForFunction function, void* context) {
+    if (count <= 0) return;
+    int threads = JobSystem_ThreadCount();
+    int grain = count / (threads * PARALLEL_FOR_SPLITS);
+    if (grain < minGrain) grain = minGrain;
+    if (grain < 1) grain = 1;
+    if (threads == 1 || count <= grain) {
+        function(0, count, context);
+        return;
+    }
+
+    ParallelForRange range = { function, context, 0, count, grain };
+    Job* root = Job_Create(parallelForJob, &range, sizeof(range), NULL);
+    Job_Run(root);
+    Job_Wait(root);
+}
@@ -0,0 +1,42 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stddef.h>
+
+#define JOB_DATA_SIZE 64 // bytes of payload copied into each job
+
+typedef struct Job Job;
+typedef void (*JobFunction)(Job* job, void* data);
+typedef void (*ParallelForFunction)(int begin, int end, void* context);
+
+// Start the worker threads, numWorkers <= 0 uses one thread per core (the caller counts as one).
+// Every physics stage submits to this one pool so parallel stages never oversubscribe the machine.
+void JobSystem_Init(int numWorkers);
+
+// Stop and join the workers, all jobs must have finished
+void JobSystem_Shutdown(void);
+
+// Number of threads executing jobs, including the thread that called JobSystem_Init
+int JobSystem_ThreadCount(void);
+
+// Whether JobSystem_Init has started the workers, so a library can tell if it owns them
+int JobSystem_IsRunning(void);
+
+// Create a job running function(job, copy of data). A job only finishes once all of its
+// children (jobs created with it as parent) have finished.
+Job* Job_Create(JobFunction function, const void* data, size_t size, Job* parent);
+
+// Start continuation as soon as job has finished, must be called before Job_Run(job)
+void Job_AddContinuation(Job* job, Job* continuation);
+
+// Queue the job on the calling thread's deque, idle workers steal from it
+void Job_Run(Job* job);
+
+// Execute other jobs until job has finished
+void Job_Wait(const Job* job);
+
+// Call function over [0, count) in ranges split recursively down to an adaptive grain size
+// (at least minGrain), and wait for all of them. Runs inline when the job system is not started.
+void JobSystem_ParallelFor(int count, int minGrain, ParallelForFunction function, void* context);
+
+#endif // JOBS_H
@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #define GLFW_INCLUDE_NONE
 #include "../include/glad/glad.h"
 #include "ui_elements.h"
@@ -5,14 +6,37 @@
 #include <GL/gl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h> // For sin and cos functions
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "fluidsim.h"
 #include "physics.h"
 #include "circle.h"
-
-#define M_PI 3.14159265358979323846
-#define MAX_CIRCLES 1000
-#define CIRCLE_NBR_SEGMENTS 100
+#include "ensemble.h"
+#include "sweep.h"
+#include "jobs.h"
+#include "snapshot.h"
+#include "recorder.h"
+#include "trajectory.h"
+#include "vtk_export.h"
+#include "render.h"
+#include "offscreen.h"
+
+#define MAX_CIRCLES 1000 // default particle count
 #define GRID_LENGTH 100
+#define PHYSICS_STEPS_PER_SECOND 60
+#define RECORDER_RING_FRAMES 16
+#define STREAM_REGIONS 4 // snapshot slots in the mapped position buffer
+#define SCROLL_ZOOM_STEP 1.1f
+#define OFFSCREEN_WRITER_FRAMES 8 // frames queued for the image writer before rendering waits
+#define HEATMAP_RESOLUTION 256 // texels per side of the heatmap accumulation texture
+#define WINDOW_WIDTH 940
+#define WINDOW_HEIGHT 880
+#define REPLAY_SEEK_SECONDS 5.0
+#define REPLAY_MAX_SPEED 64.0
 
 //typedef struct {
 //    float xPos;
@@ -26,7 +50,7 @@
 
 
 // Vertex Shader source code
-const char* vertexShaderSource = "#version 460 core\n"
+const char* vertexShaderSource = "#version 450 core\n"
     "layout(location = 0) in vec2 aPos;\n"
     "uniform vec2 offset;\n"
     "void main() {\n"
@@ -34,7 +58,7 @@ const char* vertexShaderSource = "#version 460 core\n"
     "}\0";
 
 // Fragment Shader source code
-const char* fragmentShaderSource = "#version 460 core\n"
+const char* fragmentShaderSource = "#version 450 core\n"
     "out vec4 FragColor;\n"
     "void main() {\n"
     "    FragColor = vec4(1.0, 1.0, 1.0, 1.0);\n" // White color
@@ -42,157 +66,709 @@ const char* fragmentShaderSource = "#version 460 core\n"
 
 
 UIButton playButton;
-int animationPlaying = 0;
-
-// Function to compile shader and check errors
-GLuint compileShader(GLenum type, const char* source) {
-    GLuint shader = glCreateShader(type);
-    glShaderSource(shader, 1, &source, NULL);
-    glCompileShader(shader);
-
-    // Check compile errors
-    GLint success;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetShaderInfoLog(shader, 512, NULL, infoLog);
-        fprintf(stderr, "Shader compilation failed:\n%s\n", infoLog);
-        exit(EXIT_FAILURE);
+atomic_int animationPlaying = 0;
+
+// Physics runs on its own thread and hands finished states to the render loop
+StateSnapshot stateSnapshot;
+atomic_bool physicsRunning = 0;
+FluidWorld* world = NULL; // stepped by the physics thread while it runs
+
+// Periodic checkpoints, disabled while checkpointPath is NULL
+const char* checkpointPath = NULL;
+int checkpointEvery = 0;
+
+// Reproducible runs for comparing against golden states: nothing may depend on timing, and the
+// state hash is printed with every checkpoint and at exit
+bool deterministic = false;
+
+// Trajectory recording, fed by the physics thread
+Recorder recorder;
+bool recording = false;
+
+// ParaView export every vtkEvery steps
+VTKSeries vtkSeries;
+int vtkEvery = 0;
+float* exportDensity = NULL;
+float* exportPressure = NULL;
+
+// Playback of a recorded trajectory in place of the simulation
+Trajectory replay;
+bool replaying = false;
+double replayFrame = 0.0;     // fractional, advances with wall-clock time while playing
+double replaySpeed = 1.0;
+
+// Particles are drawn as instanced impostor quads unless --render mesh asks for the triangle fans
+bool meshCircles = false;
+ImpostorRenderer impostorRenderer;
+MeshRenderer meshRenderer;
+StreamBuffer positionStream;   // snapshot slots live here while the impostors draw a running simulation
+bool streaming = false;
+float* particleRadii = NULL;   // by particle index, for replayed frames that carry only positions
+int viewportWidth, viewportHeight;
+
+// Heatmaps replace the particles when on, H cycles through them. The physics thread publishes the
+// speed or pressure of every particle along with the state while a mode needs them.
+HeatmapRenderer heatmapRenderer;
+atomic_int heatmapMode = HEATMAP_OFF;
+float* heatmapValues = NULL;
+float* heatmapDensity = NULL;  // scratch for the density the pressure pass writes alongside
+int stepFieldCount = 0;  // particles whose pressure the last step left in heatmapValues, 0 if none
+const char* heatmapNames[HEATMAP_NUM_MODES] = { "off", "density", "speed", "pressure" };
+
+// Zoom with the scroll wheel, pan by dragging anywhere but the play button
+Camera2D camera;
+bool dragging = false;
+float dragX, dragY;
+
+// Cursor position in NDC (-1 to 1), with (0,0) at the centre of the window
+void cursorToNDC(GLFWwindow* window, float* x, float* y) {
+    // Get cursor position in window coordinates (top-left origin)
+    double xpos, ypos;
+    glfwGetCursorPos(window, &xpos, &ypos);
+
+    // Get window size
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+
+    *x = (float)((xpos / width) * 2.0 - 1.0);
+    *y = (float)(1.0 - (ypos / height) * 2.0); // flip y axis
+}
+
+// Start or stop playing, returns whether it now plays. A replay stopped at its last frame starts
+// over from the first.
+int togglePlayback(void) {
+    int playing = !atomic_fetch_xor(&animationPlaying, 1);
+    if (playing && replaying && replayFrame >= replay.numFrames - 1) {
+        replayFrame = 0.0;
     }
-    return shader;
+    return playing;
 }
 
-// Create a shader program
-GLuint createShaderProgram() {
-    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-
-    GLuint program = glCreateProgram();
-    glAttachShader(program, vertexShader);
-    glAttachShader(program, fragmentShader);
-    glLinkProgram(program);
-
-    // Check linking errors
-    GLint success;
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success) {
-        char infoLog[512];
-        glGetProgramInfoLog(program, 512, NULL, infoLog);
-        fprintf(stderr, "Shader linking failed:\n%s\n", infoLog);
-        exit(EXIT_FAILURE);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+    (void)mods;
+    if (button != GLFW_MOUSE_BUTTON_LEFT) {
+        return;
     }
+    if (action == GLFW_PRESS) {
+        float x_ndc, y_ndc;
+        cursorToNDC(window, &x_ndc, &y_ndc);
 
-    // shaders no longer needed after linking
-    glDeleteShader(vertexShader);
-    glDeleteShader(fragmentShader);
+        // Check if click is inside the play button's area
+        if (UIButton_IsClicked(&playButton, x_ndc, y_ndc)) {
+            int playing = togglePlayback();
+            printf("Animation %s\n", playing ? "started" : "stopped");
+        } else {
+            dragging = true;
+            dragX = x_ndc;
+            dragY = y_ndc;
+        }
+    } else if (action == GLFW_RELEASE) {
+        dragging = false;
+    }
+}
 
-    return program;
+void cursor_position_callback(GLFWwindow* window, double xpos, double ypos) {
+    (void)xpos;
+    (void)ypos;
+    if (!dragging) {
+        return;
+    }
+    float x_ndc, y_ndc;
+    cursorToNDC(window, &x_ndc, &y_ndc);
+    Camera2D_Pan(&camera, x_ndc - dragX, y_ndc - dragY);
+    dragX = x_ndc;
+    dragY = y_ndc;
 }
 
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
+    (void)xoffset;
+    float x_ndc, y_ndc;
+    cursorToNDC(window, &x_ndc, &y_ndc);
+    Camera2D_ZoomAt(&camera, powf(SCROLL_ZOOM_STEP, (float)yoffset), x_ndc, y_ndc);
+}
 
-void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+// H cycles the heatmaps. Replay controls: space plays/pauses (from the start again at the end),
+// left/right seek, up/down change speed, home/end jump
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    (void)window;
+    (void)scancode;
     (void)mods;
-    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
-        // Get cursor position in window coordinates (top-left origin)
-        double xpos, ypos;
-        glfwGetCursorPos(window, &xpos, &ypos);
-
-        // Get window size
-        int width, height;
-        glfwGetWindowSize(window, &width, &height);
+    if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+        int mode = (atomic_load(&heatmapMode) + 1) % HEATMAP_NUM_MODES;
+        atomic_store(&heatmapMode, mode);
+        printf("Heatmap %s\n", heatmapNames[mode]);
+        return;
+    }
+    if (!replaying || (action != GLFW_PRESS && action != GLFW_REPEAT)) {
+        return;
+    }
+    double framesPerSecond = (double)PHYSICS_STEPS_PER_SECOND / replay.header->every;
+    switch (key) {
+        case GLFW_KEY_SPACE: togglePlayback(); break;
+        case GLFW_KEY_RIGHT: replayFrame += REPLAY_SEEK_SECONDS * framesPerSecond; break;
+        case GLFW_KEY_LEFT: replayFrame -= REPLAY_SEEK_SECONDS * framesPerSecond; break;
+        case GLFW_KEY_HOME: replayFrame = 0.0; break;
+        case GLFW_KEY_END: replayFrame = replay.numFrames - 1; break;
+        case GLFW_KEY_UP: replaySpeed = fmin(replaySpeed * 2.0, REPLAY_MAX_SPEED); break;
+        case GLFW_KEY_DOWN: replaySpeed = fmax(replaySpeed * 0.5, 1.0 / REPLAY_MAX_SPEED); break;
+        default: return;
+    }
+    replayFrame = fmax(0.0, fmin(replayFrame, replay.numFrames - 1));
+    printf("Replay frame %d/%d at %gx\n", (int)replayFrame, replay.numFrames, replaySpeed);
+}
 
-        // Convert window coordinates to NDC (-1 to 1), with (0,0) at center
-        float x_ndc = (float)((xpos / width) * 2.0 - 1.0);
-        float y_ndc = (float)(1.0 - (ypos / height) * 2.0); // flip y axis
+// Renderer sized for every particle it may draw, with radii: those recorded with a replay, otherwise
+// the world's, and the default lattice radius for replayed particles past the end of the world
+void initializeRenderer() {
+    const Circle* circles = FluidWorld_Circles(world);
+    int numCircles = FluidWorld_Capacity(world);
+    int capacity = numCircles;
+    if (replaying && replay.header->numParticles > capacity) {
+        capacity = replay.header->numParticles;
+    }
 
-        // Check if click is inside the play button's area
-        if (UIButton_IsClicked(&playButton, x_ndc, y_ndc)) {
-            animationPlaying = !animationPlaying;
-            printf("Animation %s\n", animationPlaying ? "started" : "stopped");
+    particleRadii = malloc(sizeof(float) * capacity);
+    if (!particleRadii) {
+        fprintf(stderr, "Failed to allocate memory for particle radii\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < capacity; i++) {
+        if (replaying && replay.radii && i < replay.header->numParticles) {
+            particleRadii[i] = replay.radii[i];
+        } else {
+            particleRadii[i] = i < numCircles ? circles[i].radius : 0.007f;
+        }
+    }
+    if (meshCircles) {
+        if (MeshRenderer_Init(&meshRenderer, capacity) != 0) {
+            exit(EXIT_FAILURE);
         }
+    } else {
+        ImpostorRenderer_Init(&impostorRenderer, capacity);
+    }
+    heatmapValues = malloc(sizeof(float) * numCircles);
+    heatmapDensity = malloc(sizeof(float) * numCircles);
+    if (!heatmapValues || !heatmapDensity) {
+        fprintf(stderr, "Failed to allocate memory for heatmap values\n");
+        exit(EXIT_FAILURE);
+    }
+    if (HeatmapRenderer_Init(&heatmapRenderer, capacity, HEATMAP_RESOLUTION) != 0) {
+        exit(EXIT_FAILURE);
     }
+    Camera2D_Reset(&camera);
+}
+
+// Snapshot release hook, runs on the render thread before a slot goes back to the physics thread
+void waitForStreamRegion(int slot, void* context) {
+    StreamBuffer_Wait(context, slot);
 }
 
-// Generate circle vertex positions
-void generateCircleVertices(float* vertices, float centerX, float centerY, float radius, int numSegments) {
-    vertices[0] = centerX;
-    vertices[1] = centerY;
-    for (int i = 0; i < numSegments; i++) {
-        float theta = 2.0f * M_PI * i / numSegments;
-        vertices[2 * (i + 1)] = centerX + radius * cosf(theta);
-        vertices[2 * (i + 1) +1] = centerY + radius * sinf(theta);
+// The physics thread publishes straight into the regions of a persistently mapped buffer, the
+// renderer fences each region it draws from and the snapshot waits on the fence before reuse
+int initializeStream(int capacity) {
+    if (StreamBuffer_Init(&positionStream, sizeof(float) * 4 * (size_t)capacity, STREAM_REGIONS) != 0) {
+        return -1;
+    }
+    // Positions, radii and heatmap values in every region
+    float* positions[STREAM_REGIONS];
+    float* radii[STREAM_REGIONS];
+    float* values[STREAM_REGIONS];
+    for (int r = 0; r < STREAM_REGIONS; r++) {
+        positions[r] = StreamBuffer_Region(&positionStream, r);
+        radii[r] = positions[r] + 2 * (size_t)capacity;
+        values[r] = radii[r] + capacity;
     }
+    streaming = true;
+    return Snapshot_InitMapped(&stateSnapshot, capacity, positions, radii, values, STREAM_REGIONS,
+                               waitForStreamRegion, &positionStream);
 }
 
-Circle circles[MAX_CIRCLES];
+// Live states go through the mapped stream when the impostors draw them, through the heap otherwise
+void initializeSnapshot() {
+    int result = meshCircles || replaying ? Snapshot_Init(&stateSnapshot, FluidWorld_Capacity(world))
+                                          : initializeStream(FluidWorld_Capacity(world));
+    if (result != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
 
-void initializeCircles() {
-    float spacing = 0.004f;
+void destroyRenderer() {
+    Snapshot_Destroy(&stateSnapshot);
+    if (streaming) {
+        StreamBuffer_Destroy(&positionStream);
+    }
+    if (meshCircles) {
+        MeshRenderer_Destroy(&meshRenderer);
+    } else {
+        ImpostorRenderer_Destroy(&impostorRenderer);
+    }
+    HeatmapRenderer_Destroy(&heatmapRenderer);
+    free(heatmapValues);
+    free(heatmapDensity);
+    free(particleRadii);
+}
 
-    float* circleVertices = malloc(sizeof(float) * 2 * CIRCLE_NBR_SEGMENTS * MAX_CIRCLES);
-    if (!circleVertices) {
-        fprintf(stderr, "Failed to allocate memory for circle\n");
-        exit(EXIT_FAILURE);
+void renderCircles(const SnapshotSlot* state) {
+    HeatmapMode heatmap = (HeatmapMode)atomic_load(&heatmapMode);
+    if (heatmap != HEATMAP_OFF) {
+        if (streaming && state->index >= 0) {
+            HeatmapRenderer_DrawStream(&heatmapRenderer, &positionStream, state, &camera, heatmap,
+                                       viewportWidth, viewportHeight);
+            StreamBuffer_Fence(&positionStream, state->index);
+        } else {
+            HeatmapRenderer_Draw(&heatmapRenderer, state, &camera, heatmap, viewportWidth, viewportHeight);
+        }
+        return;
     }
+    if (!meshCircles) {
+        if (streaming && state->index >= 0) {
+            ImpostorRenderer_DrawStream(&impostorRenderer, &positionStream, state, &camera,
+                                        viewportWidth, viewportHeight);
+            StreamBuffer_Fence(&positionStream, state->index);
+        } else {
+            ImpostorRenderer_Draw(&impostorRenderer, state, &camera, viewportWidth, viewportHeight);
+        }
+        return;
+    }
+    // Clip space spans 2 units across the viewport, size the fans for the longer axis
+    int pixels = viewportWidth > viewportHeight ? viewportWidth : viewportHeight;
+    MeshRenderer_Draw(&meshRenderer, state, &camera, 0.5f * pixels);
+}
+
+// Advance one step. When its state is about to be published with the pressure heatmap, the step
+// writes the pressure from its own neighbour search so publishState needs no second grid build.
+void stepWorld(bool publishing) {
+    bool pressure = publishing && atomic_load(&heatmapMode) == HEATMAP_PRESSURE;
+    int count = FluidWorld_ActiveCount(world);
+    setDensityPressureOutput(pressure ? heatmapDensity : NULL, pressure ? heatmapValues : NULL);
+    FluidWorld_Step(world, 1);
+    setDensityPressureOutput(NULL, NULL);
+    stepFieldCount = pressure ? count : 0;
+}
 
+// Sort the particles into the snapshot's back slot and hand it to the renderer, with the values
+// the current heatmap shows
+void publishState(long long step) {
+    const Circle* circles = FluidWorld_Circles(world);
+    int count = FluidWorld_ActiveCount(world);
+    const float* values = NULL;
+    switch (atomic_load(&heatmapMode)) {
+        case HEATMAP_SPEED:
+            for (int i = 0; i < count; i++) {
+                heatmapValues[i] = sqrtf(circles[i].xVelocity * circles[i].xVelocity +
+                                         circles[i].yVelocity * circles[i].yVelocity);
+            }
+            values = heatmapValues;
+            break;
+        case HEATMAP_PRESSURE:
+            // Particles emitted since the step have no field yet, compute all of them then
+            if (stepFieldCount != count) FluidWorld_DensityPressure(world, heatmapDensity, heatmapValues);
+            values = heatmapValues;
+            break;
+        default: break;
+    }
+    stepFieldCount = 0;
+    SnapshotSlot* slot = Snapshot_BeginWrite(&stateSnapshot);
+    Snapshot_Fill(&stateSnapshot, slot, circles, values, count);
+    slot->step = step;
+    Snapshot_Publish(&stateSnapshot);
+}
 
-    for (int i = 0; i < MAX_CIRCLES; i++) {
-        int row = i / GRID_LENGTH;
-        int col = i % GRID_LENGTH;
-        float offset = (MAX_CIRCLES/GRID_LENGTH )* spacing*2;
-    
+void printStateHash(void) {
+    printf("State hash at step %lld: %016llx\n", FluidWorld_StepIndex(world),
+           (unsigned long long)FluidWorld_StateHash(world));
+}
 
-        circles[i].xPos = col * spacing - offset ;//(float)(i * 0.1f); // Example positions
-        circles[i].yPos = row * spacing; //(float)(i * 0.1f);
+void saveCheckpoint(void) {
+    if (FluidWorld_SaveCheckpoint(world, checkpointPath) == 0) {
+        printf("Checkpoint of step %lld written to %s\n", FluidWorld_StepIndex(world), checkpointPath);
+    }
+    if (deterministic) {
+        printStateHash();
+    }
+}
 
-        circles[i].radius = 0.007f;
-        circles[i].xVelocity = 0.5f * ((float)rand()/RAND_MAX);
-        circles[i].yVelocity = 0.01f * ((float)rand()/RAND_MAX);
+void drawReplayFrame(int index);
 
-        // Generate circle vertices
-        //int numSegments = 100;
-        
-        generateCircleVertices(&circleVertices[i * 2 * CIRCLE_NBR_SEGMENTS], 0.0f, 0.0f, circles[i].radius, CIRCLE_NBR_SEGMENTS);
+// Advance the replay clock by the wall-clock time since the last frame and draw the frame under it
+void renderReplay(double elapsed) {
+    if (atomic_load(&animationPlaying)) {
+        replayFrame += elapsed * replaySpeed * PHYSICS_STEPS_PER_SECOND / replay.header->every;
+        if (replayFrame >= replay.numFrames - 1) {
+            replayFrame = replay.numFrames - 1;
+            atomic_store(&animationPlaying, 0); // stop at the end of the recording
+        }
     }
-    // Generate VAO and VBO
-    glGenVertexArrays(1, &circles[0].VAO);
-    glGenBuffers(1, &circles[0].VBO);
 
-    glBindVertexArray(circles[0].VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, circles[0].VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * CIRCLE_NBR_SEGMENTS *MAX_CIRCLES, circleVertices, GL_STATIC_DRAW);
+    drawReplayFrame((int)replayFrame);
+}
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
+void drawReplayFrame(int index) {
+    long long step;
+    int activeCount;
+    const float* positions = Trajectory_Frame(&replay, index, &step, &activeCount);
+    if (!positions) {
+        return;
+    }
+    // Frames are in particle order and not sorted into cells, so they are drawn whole
+    SnapshotSlot frame = { 0 };
+    frame.positions = (float*)positions;
+    frame.radii = particleRadii;
+    frame.count = activeCount;
+    frame.step = step;
+    frame.index = -1;
+    renderCircles(&frame);
+}
 
-    glBindVertexArray(0);
-    free(circleVertices);
-    
+// Recording, export and checkpoints due after the world reached the given step
+void afterStep(long long step) {
+    if (recording) {
+        Recorder_Record(&recorder, FluidWorld_Circles(world), FluidWorld_ActiveCount(world), step);
+    }
+    if (vtkEvery > 0 && step % vtkEvery == 0) {
+        FluidParameters parameters;
+        FluidWorld_GetParameters(world, &parameters);
+        FluidWorld_DensityPressure(world, exportDensity, exportPressure);
+        VTKSeries_Write(&vtkSeries, FluidWorld_Circles(world), FluidWorld_ActiveCount(world),
+                        exportDensity, exportPressure, step, step * (double)parameters.timestep);
+    }
+    if (checkpointPath && checkpointEvery > 0 && step % checkpointEvery == 0) {
+        saveCheckpoint();
+    }
 }
 
-void renderCircles(GLuint shaderProgram, GLint offsetLocation) {
-    glUseProgram(shaderProgram);
-    glBindVertexArray(circles[0].VAO); // Bind the single VAO
+// Steps the simulation at a fixed rate, independently of how long frames take to render
+void* physicsThread(void* arg) {
+    (void)arg;
+    long tick = 1000000000L / PHYSICS_STEPS_PER_SECOND;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (atomic_load(&physicsRunning)) {
+        if (atomic_load(&animationPlaying)) {
+            stepWorld(true);
+            long long step = FluidWorld_StepIndex(world);
+            publishState(step);
+            afterStep(step);
+        }
+
+        next.tv_nsec += tick;
+        if (next.tv_nsec >= 1000000000L) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - next.tv_sec) * 1000000000L + (now.tv_nsec - next.tv_nsec) > tick) {
+            next = now; // fell more than a step behind, don't try to catch up
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+// Headless: step many independent copies of the default scene and report throughput
+int runEnsemble(int numInstances, int steps) {
+    Ensemble ensemble;
+    if (Ensemble_Init(&ensemble, numInstances, MAX_CIRCLES) != 0) {
+        return EXIT_FAILURE;
+    }
+    Ensemble_FillGrid(&ensemble, GRID_LENGTH, 0.004f, 0.007f, 1u);
+
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    Ensemble_Step(&ensemble, steps);
+    timespec_get(&end, TIME_UTC);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("%d instances x %d particles x %d steps in %.3f s (%.1f instance-steps/s)\n",
+           numInstances, MAX_CIRCLES, steps, seconds, numInstances * (double)steps / seconds);
+    printf("mean kinetic energy of instance 0: %f\n", Ensemble_KineticEnergy(&ensemble, 0));
+    Ensemble_Destroy(&ensemble);
+    return EXIT_SUCCESS;
+}
+
+// Headless movie export: step the world as fast as it goes and render every `every` steps into
+// an offscreen framebuffer (or render the frames of a replay), writing images in the background
+int runOffscreen(const char* output, int numFrames, int every, int width, int height) {
+    OffscreenContext context;
+    if (OffscreenContext_Create(&context, 4, 5) != 0) {
+        return EXIT_FAILURE;
+    }
+    OffscreenTarget target;
+    FrameWriter writer;
+    if (OffscreenTarget_Init(&target, width, height, 4) != 0 ||
+        FrameWriter_Open(&writer, output, width, height, OFFSCREEN_WRITER_FRAMES) != 0) {
+        OffscreenContext_Destroy(&context);
+        return EXIT_FAILURE;
+    }
+    viewportWidth = width;
+    viewportHeight = height;
+    every = every > 0 ? every : 1;
+    initializeRenderer();
+    initializeSnapshot();
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    if (replaying && numFrames > replay.numFrames) {
+        numFrames = replay.numFrames;
+    }
+
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    for (int frame = 0; frame < numFrames && !FrameWriter_Ended(&writer); frame++) {
+        if (!replaying) {
+            for (int s = 0; s < every && frame > 0; s++) {
+                stepWorld(s == every - 1);
+                afterStep(FluidWorld_StepIndex(world));
+            }
+            publishState(FluidWorld_StepIndex(world));
+        }
+        OffscreenTarget_Bind(&target);
+        glClear(GL_COLOR_BUFFER_BIT);
+        if (replaying) {
+            drawReplayFrame(frame);
+        } else {
+            renderCircles(Snapshot_Latest(&stateSnapshot));
+        }
+        OffscreenTarget_Capture(&target, &writer);
+    }
+    OffscreenTarget_Finish(&target, &writer);
+    int result = FrameWriter_Close(&writer) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    timespec_get(&end, TIME_UTC);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    printf("%lld frames of %dx%d written to %s in %.3f s\n", writer.written, width, height, output, seconds);
+    destroyRenderer();
+    OffscreenTarget_Destroy(&target);
+    OffscreenContext_Destroy(&context);
+    return result;
+}
 
-    for (int i = 0; i < MAX_CIRCLES; i++) {
-        glUniform2f(offsetLocation, circles[i].xPos, circles[i].yPos);
-        glDrawArrays(GL_TRIANGLE_FAN, i * (CIRCLE_NBR_SEGMENTS + 2), CIRCLE_NBR_SEGMENTS + 2); // Draw each circle
+// Final checkpoint or state hash, then close the outputs and the world
+void finishRun() {
+    if (replaying) {
+        Trajectory_Close(&replay);
+    } else if (checkpointPath) {
+        saveCheckpoint();
+    } else if (deterministic) {
+        printStateHash();
     }
+    if (recording) {
+        Recorder_Close(&recorder);
+    }
+    if (vtkEvery > 0) {
+        VTKSeries_Close(&vtkSeries);
+        free(exportDensity);
+        free(exportPressure);
+    }
+    PhysicsStats stats;
+    getPhysicsStats(&stats);
+    printf("Peak step arena use: %zu KiB\n", stats.arenaPeakBytes / 1024);
+    FluidWorld_Destroy(world);
+    JobSystem_Shutdown();
+}
 
-    glBindVertexArray(0);
+// Select the heatmap with the given name, returns false for unknown names
+bool parseHeatmap(const char* name) {
+    for (int mode = 0; mode < HEATMAP_NUM_MODES; mode++) {
+        if (strcmp(name, heatmapNames[mode]) == 0) {
+            atomic_store(&heatmapMode, mode);
+            return true;
+        }
+    }
+    return false;
 }
 
-int main(void) {
+int main(int argc, char** argv) {
+    const char* boundaryScene = NULL;
+    const char* sweepSpec = NULL;
+    const char* sweepResults = NULL;
+    const char* restartPath = NULL;
+    const char* replayPath = NULL;
+    const char* vtkPath = NULL;
+    const char* recordPath = NULL;
+    const char* scenePath = NULL;
+    const char* offscreenPath = NULL;
+    int offscreenFrames = 0;
+    int offscreenEvery = 1;
+    int offscreenWidth = WINDOW_WIDTH;
+    int offscreenHeight = WINDOW_HEIGHT;
+    int recordEvery = 1;
+    RecorderPolicy recordPolicy = RECORDER_DROP;
+    bool recordDirect = false;
+    TrajectoryEncoding recordEncoding = TRAJECTORY_RAW;
+    int ensembleInstances = 0;
+    int ensembleSteps = 0;
+    int numThreads = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--boundary") == 0 && i + 1 < argc) {
+            boundaryScene = argv[++i];
+        } else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            scenePath = argv[++i];
+        } else if (strcmp(argv[i], "--periodic") == 0 && i + 1 < argc) {
+            const char* axes = argv[++i];
+            setPeriodicBoundaries(strchr(axes, 'x') != NULL, strchr(axes, 'y') != NULL);
+        } else if ((strcmp(argv[i], "--gravity") == 0 || strcmp(argv[i], "--coulomb") == 0) && i + 2 < argc) {
+            LongRangeMode mode = argv[i][2] == 'g' ? LONG_RANGE_GRAVITY : LONG_RANGE_COULOMB;
+            float strength = strtof(argv[i + 1], NULL);
+            float theta = strtof(argv[i + 2], NULL);
+            setLongRangeForce(mode, strength, theta);
+            i += 2;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            setRandomSeed(strtoull(argv[++i], NULL, 10));
+        } else if (strcmp(argv[i], "--forcing") == 0 && i + 1 < argc) {
+            setRandomForcing(strtof(argv[++i], NULL));
+        } else if (strcmp(argv[i], "--deterministic") == 0) {
+            deterministic = true;
+        } else if (strcmp(argv[i], "--timestep-bins") == 0 && i + 1 < argc) {
+            setTimestepBins(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--ensemble") == 0 && i + 2 < argc) {
+            ensembleInstances = atoi(argv[i + 1]);
+            ensembleSteps = atoi(argv[i + 2]);
+            i += 2;
+        } else if (strcmp(argv[i], "--sweep") == 0 && i + 2 < argc) {
+            sweepSpec = argv[i + 1];
+            sweepResults = argv[i + 2];
+            i += 2;
+        } else if (strcmp(argv[i], "--restart") == 0 && i + 1 < argc) {
+            restartPath = argv[++i];
+        } else if (strcmp(argv[i], "--checkpoint") == 0 && i + 2 < argc) {
+            checkpointPath = argv[i + 1];
+            checkpointEvery = atoi(argv[i + 2]);
+            i += 2;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 2 < argc) {
+            recordPath = argv[i + 1];
+            recordEvery = atoi(argv[i + 2]);
+            i += 2;
+        } else if (strcmp(argv[i], "--record-block") == 0) {
+            recordPolicy = RECORDER_BLOCK;
+        } else if (strcmp(argv[i], "--record-direct") == 0) {
+            recordDirect = true;
+        } else if (strcmp(argv[i], "--record-quantised") == 0) {
+            recordEncoding = TRAJECTORY_QUANTISED;
+        } else if (strcmp(argv[i], "--vtk") == 0 && i + 2 < argc) {
+            vtkPath = argv[i + 1];
+            vtkEvery = atoi(argv[i + 2]);
+            i += 2;
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--offscreen") == 0 && i + 3 < argc) {
+            offscreenPath = argv[i + 1];
+            offscreenFrames = atoi(argv[i + 2]);
+            offscreenEvery = atoi(argv[i + 3]);
+            i += 3;
+        } else if (strcmp(argv[i], "--offscreen-size") == 0 && i + 2 < argc) {
+            offscreenWidth = atoi(argv[i + 1]);
+            offscreenHeight = atoi(argv[i + 2]);
+            i += 2;
+        } else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+            meshCircles = strcmp(argv[++i], "mesh") == 0;
+        } else if (strcmp(argv[i], "--heatmap") == 0 && i + 1 < argc && parseHeatmap(argv[i + 1])) {
+            i++;
+        } else {
+            fprintf(stderr, "Usage: %s [--scene file.scene] [--boundary scene.poly] [--periodic x|y|xy]"
+                            " [--gravity|--coulomb strength theta] [--timestep-bins levels]"
+                            " [--seed n] [--forcing amplitude] [--deterministic]"
+                            " [--ensemble instances steps] [--sweep spec results.csv]"
+                            " [--restart checkpoint] [--checkpoint path every]"
+                            " [--record trajectory every [--record-block] [--record-direct] [--record-quantised]]"
+                            " [--vtk base every] [--replay trajectory] [--threads n]"
+                            " [--render impostor|mesh] [--heatmap density|speed|pressure]"
+                            " [--offscreen base|'|command' frames every [--offscreen-size width height]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // A replay runs no simulation, so these outputs would only be truncated and left empty
+    if (replayPath && (recordPath || vtkPath)) {
+        fprintf(stderr, "--replay can't be combined with --record or --vtk\n");
+        exit(EXIT_FAILURE);
+    }
+    if (deterministic) {
+        recordPolicy = RECORDER_BLOCK; // dropped frames would depend on disk and scheduler timing
+    }
+
+    // In the window the main thread renders and never runs jobs, the physics thread takes its
+    // place by running jobs while it waits on them. By default the pool therefore counts one
+    // thread per core left after the render thread. --threads n is taken as given.
+    bool windowed = !sweepSpec && ensembleInstances <= 0 && !offscreenPath;
+    if (windowed && numThreads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = cores > 1 ? (int)cores - 1 : 1;
+    }
+    JobSystem_Init(numThreads);
+
+    if (sweepSpec) {
+        int result = Sweep_Run(sweepSpec, sweepResults) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        JobSystem_Shutdown();
+        return result;
+    }
+    if (ensembleInstances > 0) {
+        int result = runEnsemble(ensembleInstances, ensembleSteps);
+        JobSystem_Shutdown();
+        return result;
+    }
+
+    // The world starts from the settings made on the command line, a scene overrides those it names
+    FluidWorldDesc desc = { MAX_CIRCLES, scenePath, boundaryScene, numThreads };
+    world = FluidWorld_Create(&desc);
+    if (!world) {
+        exit(EXIT_FAILURE);
+    }
+    if (scenePath) {
+        printf("Scene %s: %d particles, %d of them emitted\n", scenePath, FluidWorld_Capacity(world),
+               FluidWorld_Capacity(world) - FluidWorld_ActiveCount(world));
+    }
+
+    if (replayPath) {
+        if (Trajectory_Open(&replay, replayPath) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        if (replay.numFrames == 0) {
+            fprintf(stderr, "Trajectory %s holds no frames\n", replayPath);
+            exit(EXIT_FAILURE);
+        }
+        replaying = true;
+    }
+
+    if (restartPath && FluidWorld_LoadCheckpoint(world, restartPath) != 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    if (recordPath) {
+        if (Recorder_Open(&recorder, recordPath, FluidWorld_Circles(world), FluidWorld_Capacity(world),
+                          RECORDER_RING_FRAMES, recordEvery, recordPolicy, recordDirect, recordEncoding) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        recording = true;
+    }
+    if (vtkPath && vtkEvery > 0) {
+        exportDensity = malloc(sizeof(float) * FluidWorld_Capacity(world));
+        exportPressure = malloc(sizeof(float) * FluidWorld_Capacity(world));
+        if (!exportDensity || !exportPressure || VTKSeries_Open(&vtkSeries, vtkPath) != 0) {
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        vtkEvery = 0;
+    }
+
+    if (offscreenPath) {
+        int result = runOffscreen(offscreenPath, offscreenFrames, offscreenEvery, offscreenWidth, offscreenHeight);
+        finishRun();
+        return result;
+    }
+
     if (!glfwInit()) {
         exit(EXIT_FAILURE);
     }
     glfwWindowHint(GLFW_SAMPLES, 4); // Enable 4x multisampling
 
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); //Set the version to 4.6
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); //Set the version to 4.5
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
 
 
-    GLFWwindow* window = glfwCreateWindow(940, 880, "FLUIDSIMULATIONS", NULL, NULL); //Create window
+    GLFWwindow* window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "FLUIDSIMULATIONS", NULL, NULL); //Create window
     // Handle if for some reason window does not work
     if (!window) { 
         glfwTerminate();
@@ -202,6 +778,9 @@ int main(void) {
     glfwMakeContextCurrent(window); // Make the OpenGL context current
 
     glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetCursorPosCallback(window, cursor_position_callback);
+    glfwSetScrollCallback(window, scroll_callback);
 
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
         fprintf(stderr, "Failed to initialize GLAD\n");
@@ -212,40 +791,45 @@ int main(void) {
     glEnable(GL_MULTISAMPLE); // Enable multisampling
 
 
-    int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
-    glViewport(0, 0, width, height);
+    glfwGetFramebufferSize(window, &viewportWidth, &viewportHeight);
+    glViewport(0, 0, viewportWidth, viewportHeight);
 
     // Compile shaders and create shader program
-    GLuint shaderProgram = createShaderProgram();
+    GLuint shaderProgram = Render_CreateProgram(vertexShaderSource, fragmentShaderSource);
 
     GLint offsetLocation = glGetUniformLocation(shaderProgram, "offset");
 
 
     UIButton_Init(&playButton);
     
-    initializeCircles();
+    initializeRenderer();
+    initializeSnapshot();
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
+    publishState(FluidWorld_StepIndex(world));
+    pthread_t physics;
+    if (!replaying) {
+        atomic_store(&physicsRunning, 1);
+        if (pthread_create(&physics, NULL, physicsThread, NULL) != 0) {
+            fprintf(stderr, "Failed to start physics thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    float timestep = 0.05f;
-
-
+    double lastFrameTime = glfwGetTime();
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
+        double frameTime = glfwGetTime();
 
         // Clear screen
         glClear(GL_COLOR_BUFFER_BIT);
 
-        glUseProgram(shaderProgram);
-
         // Render circles if animation is playing
-        if (animationPlaying) {
-            updatePosition(circles, MAX_CIRCLES, timestep);//(&circles[i].xPos, &circles[i].yPos, &circles[i].xVelocity, &circles[i].yVelocity, timestep);
-
-
-            renderCircles(shaderProgram,offsetLocation);
+        if (replaying) {
+            renderReplay(frameTime - lastFrameTime);
+        } else if (atomic_load(&animationPlaying)) {
+            renderCircles(Snapshot_Latest(&stateSnapshot));
             //for (int i = 0; i < MAX_CIRCLES; i++) {
             //    glUniform2f(offsetLocation, circles[i].xPos, circles[i].yPos);
             //    glBindVertexArray(circles[i].VAO);
@@ -258,6 +842,7 @@ int main(void) {
 
         // Render play button (static, unaffected by animation)
         glBindVertexArray(0); // Unbind any VAOs
+        glUseProgram(shaderProgram); // the particle renderers bind their own programs
         glUniform2f(offsetLocation, 0.0f, 0.0f); 
 
         UIButton_Render(&playButton);
@@ -266,12 +851,19 @@ int main(void) {
         glBindVertexArray(0);
 
         glfwSwapBuffers(window);
+        lastFrameTime = frameTime;
     }
 
 
 
     //clean up
+    if (!replaying) {
+        atomic_store(&physicsRunning, 0);
+        pthread_join(physics, NULL);
+    }
+    destroyRenderer();
     UIButton_Destroy(&playButton);
+    finishRun();
     glfwDestroyWindow(window);
     glfwTerminate();
     return 0;
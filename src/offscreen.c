@@ -0,0 +1,362 @@
+#define _POSIX_C_SOURCE 200809L // popen
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "offscreen.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+int OffscreenContext_Create(OffscreenContext* offscreen, int major, int minor) {
+    memset(offscreen, 0, sizeof(*offscreen));
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    offscreen->display = EGL_NO_DISPLAY;
+    if (getPlatformDisplay) {
+        offscreen->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (offscreen->display == EGL_NO_DISPLAY) {
+        offscreen->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    EGLint eglMajor, eglMinor;
+    if (offscreen->display == EGL_NO_DISPLAY || !eglInitialize(offscreen->display, &eglMajor, &eglMinor)) {
+        fprintf(stderr, "Failed to initialize EGL (error 0x%x)\n", eglGetError());
+        return -1;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        fprintf(stderr, "EGL display has no desktop OpenGL\n");
+        OffscreenContext_Destroy(offscreen);
+        return -1;
+    }
+
+    // Rendering goes to framebuffer objects, so any config will do, or none where that's allowed
+    const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+    EGLConfig config = (EGLConfig)0;
+    EGLint numConfigs = 0;
+    eglChooseConfig(offscreen->display, configAttributes, &config, 1, &numConfigs);
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, major,
+        EGL_CONTEXT_MINOR_VERSION, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    offscreen->context = eglCreateContext(offscreen->display, numConfigs > 0 ? config : (EGLConfig)0,
+                                          EGL_NO_CONTEXT, contextAttributes);
+    if (offscreen->context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(offscreen->display, EGL_NO_SURFACE, EGL_NO_SURFACE, offscreen->context)) {
+        fprintf(stderr, "Failed to create a surfaceless OpenGL %d.%d context (error 0x%x)\n",
+                major, minor, eglGetError());
+        OffscreenContext_Destroy(offscreen);
+        return -1;
+    }
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+        fprintf(stderr, "Failed to initialize GLAD\n");
+        OffscreenContext_Destroy(offscreen);
+        return -1;
+    }
+    return 0;
+}
+
+void OffscreenContext_Destroy(OffscreenContext* offscreen) {
+    if (offscreen->display == EGL_NO_DISPLAY) return;
+    eglMakeCurrent(offscreen->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (offscreen->context != EGL_NO_CONTEXT) {
+        eglDestroyContext(offscreen->display, offscreen->context);
+    }
+    eglTerminate(offscreen->display);
+    offscreen->display = EGL_NO_DISPLAY;
+    offscreen->context = EGL_NO_CONTEXT;
+}
+
+static size_t frameBytes(const FrameWriter* writer) {
+    return (size_t)writer->width * writer->height * 4;
+}
+
+// Flip the bottom-up RGBA image to top-down RGB while writing it. Returns 1 when the command
+// behind the pipe has gone away.
+static int writeImage(FrameWriter* writer, const unsigned char* pixels, long long index) {
+    FILE* file = writer->pipe;
+    if (!file) {
+        char path[1100];
+        snprintf(path, sizeof(path), "%s_%05lld.ppm", writer->basePath, index);
+        file = fopen(path, "wb");
+        if (!file) {
+            fprintf(stderr, "Could not write frame %s\n", path);
+            return -1;
+        }
+        fprintf(file, "P6\n%d %d\n255\n", writer->width, writer->height);
+    }
+    int result = 0;
+    for (int y = writer->height - 1; y >= 0 && result == 0; y--) {
+        const unsigned char* source = pixels + (size_t)y * writer->width * 4;
+        for (int x = 0; x < writer->width; x++) {
+            writer->row[3 * x] = source[4 * x];
+            writer->row[3 * x + 1] = source[4 * x + 1];
+            writer->row[3 * x + 2] = source[4 * x + 2];
+        }
+        if (fwrite(writer->row, 3, (size_t)writer->width, file) != (size_t)writer->width) {
+            result = writer->pipe && errno == EPIPE ? 1 : -1;
+        }
+    }
+    if (!writer->pipe && fclose(file) != 0) {
+        result = -1;
+    }
+    if (result < 0) {
+        fprintf(stderr, "Failed to write frame %lld\n", index);
+    }
+    return result;
+}
+
+static void* writerThread(void* arg) {
+    FrameWriter* writer = arg;
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (writer->queued == 0 && writer->running) {
+            pthread_cond_wait(&writer->frameQueued, &writer->lock);
+        }
+        if (writer->queued == 0) break; // stopped and drained
+
+        // The tail slot stays ours until it is released below
+        int slot = writer->tail;
+        pthread_mutex_unlock(&writer->lock);
+        bool skip = writer->failed || writer->ended;
+        int result = skip ? 0 : writeImage(writer, writer->frames + frameBytes(writer) * slot, writer->written);
+        pthread_mutex_lock(&writer->lock);
+        if (result > 0) {
+            printf("Frame encoder stopped reading after %lld frames\n", writer->written);
+            writer->ended = true;
+        } else if (result < 0) {
+            writer->failed = 1;
+        } else if (!skip) {
+            writer->written++;
+        }
+
+        writer->tail = (slot + 1) % writer->numFrames;
+        writer->queued--;
+        pthread_cond_signal(&writer->frameWritten);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+int FrameWriter_Open(FrameWriter* writer, const char* basePath, int width, int height, int numFrames) {
+    memset(writer, 0, sizeof(*writer));
+    writer->width = width;
+    writer->height = height;
+    writer->numFrames = numFrames > 0 ? numFrames : 1;
+    if (basePath[0] == '|') {
+        // A command that exits early must not kill us with SIGPIPE, the write reports EPIPE instead
+        signal(SIGPIPE, SIG_IGN);
+        writer->pipe = popen(basePath + 1, "w");
+        if (!writer->pipe) {
+            fprintf(stderr, "Could not start frame encoder %s\n", basePath + 1);
+            return -1;
+        }
+    } else {
+        snprintf(writer->basePath, sizeof(writer->basePath), "%s", basePath);
+    }
+
+    writer->frames = malloc(frameBytes(writer) * writer->numFrames);
+    writer->row = malloc((size_t)width * 3);
+    if (!writer->frames || !writer->row) {
+        fprintf(stderr, "Failed to allocate memory for frame writer\n");
+        free(writer->frames);
+        free(writer->row);
+        if (writer->pipe) pclose(writer->pipe);
+        return -1;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->frameQueued, NULL);
+    pthread_cond_init(&writer->frameWritten, NULL);
+    writer->running = true;
+    if (pthread_create(&writer->writer, NULL, writerThread, writer) != 0) {
+        fprintf(stderr, "Failed to start frame writer\n");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+unsigned char* FrameWriter_BeginFrame(FrameWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->queued == writer->numFrames) {
+        pthread_cond_wait(&writer->frameWritten, &writer->lock);
+    }
+    int slot = writer->head;
+    pthread_mutex_unlock(&writer->lock);
+    // The head slot is invisible to the writer until it is queued
+    return writer->frames + frameBytes(writer) * slot;
+}
+
+bool FrameWriter_Ended(FrameWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    bool ended = writer->ended;
+    pthread_mutex_unlock(&writer->lock);
+    return ended;
+}
+
+void FrameWriter_Submit(FrameWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->head = (writer->head + 1) % writer->numFrames;
+    writer->queued++;
+    pthread_cond_signal(&writer->frameQueued);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+int FrameWriter_Close(FrameWriter* writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->running = false;
+    pthread_cond_signal(&writer->frameQueued);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->writer, NULL);
+
+    if (writer->pipe && pclose(writer->pipe) != 0) {
+        fprintf(stderr, "Frame encoder exited with an error\n");
+        writer->failed = 1;
+    }
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->frameQueued);
+    pthread_cond_destroy(&writer->frameWritten);
+    free(writer->frames);
+    free(writer->row);
+    return writer->failed ? -1 : 0;
+}
+
+// Framebuffer with a single colour renderbuffer
+static int createFramebuffer(GLuint* framebuffer, GLuint* colorBuffer, int width, int height, int samples) {
+    glGenFramebuffers(1, framebuffer);
+    glGenRenderbuffers(1, colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, *colorBuffer);
+    if (samples > 1) {
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+    } else {
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, *framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, *colorBuffer);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Offscreen framebuffer incomplete (status 0x%x)\n", status);
+        return -1;
+    }
+    return 0;
+}
+
+int OffscreenTarget_Init(OffscreenTarget* target, int width, int height, int samples) {
+    memset(target, 0, sizeof(*target));
+    target->width = width;
+    target->height = height;
+    target->samples = samples;
+    if (createFramebuffer(&target->framebuffer, &target->colorBuffer, width, height, samples) != 0) {
+        OffscreenTarget_Destroy(target);
+        return -1;
+    }
+    if (samples > 1 &&
+        createFramebuffer(&target->resolveFramebuffer, &target->resolveBuffer, width, height, 1) != 0) {
+        OffscreenTarget_Destroy(target);
+        return -1;
+    }
+
+    glGenBuffers(2, target->pixelBuffers);
+    for (int i = 0; i < 2; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, target->pixelBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return 0;
+}
+
+void OffscreenTarget_Bind(OffscreenTarget* target) {
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+    glViewport(0, 0, target->width, target->height);
+}
+
+// Block until the readback into the pixel buffer has landed
+static void waitForReadback(OffscreenTarget* target, int buffer) {
+    GLsync fence = target->fences[buffer];
+    if (!fence) {
+        return;
+    }
+    // The first wait flushes the fence to the GPU, later ones only poll
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;) {
+        GLenum result = glClientWaitSync(fence, flags, 1000000000);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+            break;
+        }
+        if (result == GL_WAIT_FAILED) {
+            fprintf(stderr, "Waiting on pixel buffer %d failed\n", buffer);
+            break;
+        }
+        flags = 0;
+    }
+    glDeleteSync(fence);
+    target->fences[buffer] = NULL;
+}
+
+// Copy a finished pixel buffer into a free slot of the writer
+static void handOver(OffscreenTarget* target, int buffer, FrameWriter* writer) {
+    unsigned char* frame = FrameWriter_BeginFrame(writer);
+    waitForReadback(target, buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, target->pixelBuffers[buffer]);
+    const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)target->width * target->height * 4,
+                                          GL_MAP_READ_BIT);
+    if (pixels) {
+        memcpy(frame, pixels, (size_t)target->width * target->height * 4);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        memset(frame, 0, (size_t)target->width * target->height * 4);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    FrameWriter_Submit(writer);
+}
+
+void OffscreenTarget_Capture(OffscreenTarget* target, FrameWriter* writer) {
+    GLuint source = target->framebuffer;
+    if (target->samples > 1) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, target->framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target->resolveFramebuffer);
+        glBlitFramebuffer(0, 0, target->width, target->height, 0, 0, target->width, target->height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        source = target->resolveFramebuffer;
+    }
+
+    // Into a pixel buffer glReadPixels returns at once, the copy completes in the background
+    int buffer = target->frame % 2;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, target->pixelBuffers[buffer]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, target->width, target->height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    target->fences[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+
+    if (target->frame > 0) {
+        handOver(target, (target->frame - 1) % 2, writer);
+    }
+    target->frame++;
+}
+
+void OffscreenTarget_Finish(OffscreenTarget* target, FrameWriter* writer) {
+    if (target->frame > 0) {
+        handOver(target, (target->frame - 1) % 2, writer);
+    }
+}
+
+void OffscreenTarget_Destroy(OffscreenTarget* target) {
+    for (int i = 0; i < 2; i++) {
+        if (target->fences[i]) {
+            glDeleteSync(target->fences[i]);
+        }
+    }
+    glDeleteBuffers(2, target->pixelBuffers);
+    glDeleteFramebuffers(1, &target->framebuffer);
+    glDeleteRenderbuffers(1, &target->colorBuffer);
+    glDeleteFramebuffers(1, &target->resolveFramebuffer);
+    glDeleteRenderbuffers(1, &target->resolveBuffer);
+}
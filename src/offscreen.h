@@ -0,0 +1,84 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <EGL/egl.h>
+#include "../include/glad/glad.h"
+
+// GL context without a window or display server: EGL on Mesa's surfaceless platform, or the
+// default display where that isn't available. Loads the GL functions through glad.
+typedef struct {
+    EGLDisplay display;
+    EGLContext context;
+} OffscreenContext;
+
+int OffscreenContext_Create(OffscreenContext* offscreen, int major, int minor);
+void OffscreenContext_Destroy(OffscreenContext* offscreen);
+
+// Hands finished frames to a writer thread that stores them as binary PPM files base_00000.ppm,
+// base_00001.ppm, ... or, for a base of "|command", pipes raw top-down RGB24 frames into the
+// command's stdin (e.g. "|ffmpeg -f rawvideo -pix_fmt rgb24 -s 940x880 -i - out.mp4").
+// Frames queue in a ring of RGBA buffers; the renderer only waits when every slot is taken.
+// A command that stops reading (EPIPE) ends the output, later frames are dropped without error.
+typedef struct {
+    char basePath[1024];
+    FILE* pipe;
+    int width, height;
+
+    unsigned char* frames;  // ring of numFrames bottom-up RGBA images, as glReadPixels returns them
+    int numFrames;
+    int head, tail, queued; // head is the next slot to fill, tail the next to write
+    unsigned char* row;     // writer thread scratch: one RGB row
+
+    pthread_mutex_t lock;
+    pthread_cond_t frameQueued;
+    pthread_cond_t frameWritten;
+    pthread_t writer;
+    bool running;
+    bool ended;             // the command closed its input
+    long long written;      // frames stored or piped in full
+    int failed;
+} FrameWriter;
+
+int FrameWriter_Open(FrameWriter* writer, const char* basePath, int width, int height, int numFrames);
+
+// Free slot to fill with width * height RGBA pixels, waits while the ring is full
+unsigned char* FrameWriter_BeginFrame(FrameWriter* writer);
+void FrameWriter_Submit(FrameWriter* writer);
+
+// Whether the command has stopped taking frames, so there is no point rendering more
+bool FrameWriter_Ended(FrameWriter* writer);
+
+// Writes out every queued frame, then stops the writer. Returns -1 if any write failed.
+int FrameWriter_Close(FrameWriter* writer);
+
+// Framebuffer to render batch frames into, multisampled like the window and resolved before
+// readback. Readback goes through two pixel buffer objects: glReadPixels of frame n only starts
+// an asynchronous copy, and the pixels of frame n - 1, which had a frame's time to arrive, are
+// mapped and handed to the frame writer.
+typedef struct {
+    int width, height;
+    GLuint framebuffer, colorBuffer;     // render target, multisampled when samples > 1
+    GLuint resolveFramebuffer, resolveBuffer;
+    GLuint pixelBuffers[2];
+    GLsync fences[2];       // signalled once the readback into the matching pixel buffer is done
+    int samples;
+    int frame;              // frames captured so far
+} OffscreenTarget;
+
+int OffscreenTarget_Init(OffscreenTarget* target, int width, int height, int samples);
+
+// Make the target the draw framebuffer and set the viewport to it
+void OffscreenTarget_Bind(OffscreenTarget* target);
+
+// Start reading back what was drawn since Bind, and pass the previous frame to the writer
+void OffscreenTarget_Capture(OffscreenTarget* target, FrameWriter* writer);
+
+// Pass the last captured frame to the writer
+void OffscreenTarget_Finish(OffscreenTarget* target, FrameWriter* writer);
+
+void OffscreenTarget_Destroy(OffscreenTarget* target);
+
+#endif // OFFSCREEN_H
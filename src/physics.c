@@ -1,26 +1,175 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "circle.h"
+#include "physics.h"
+#include "barnes_hut.h"
+#include "jobs.h"
+#include "arena.h"
+#include "rng.h"
 
-#define ACC_GRAVITY 1
+#define ACC_GRAVITY 1.0f // default
+#define RESTITUTION 0.96f // default
 #define WINDOW_BOTTOM -1.0f  // Bottom boundary of the window
 #define WINDOW_TOP 1.0f 
 #define WINDOW_LEFT -1.0f  // Bottom boundary of the window
 #define WINDOW_RIGHT 1.0f 
+#define WINDOW_WIDTH (WINDOW_RIGHT - WINDOW_LEFT)
+#define WINDOW_HEIGHT (WINDOW_TOP - WINDOW_BOTTOM)
+#define MAX_GRID_CELLS 4096 // per axis
+#define MAX_TIMESTEP_LEVELS 8
+#define COURANT_FRACTION 0.5f
+#define PARTICLES_PER_JOB 256 // minimum grain of the parallel stages
+#define STEP_ARENA_CAPACITY ((size_t)1 << 30) // address space reserved for per-step scratch
+
+static const SDFGrid* boundarySDF = NULL;
+static bool periodicX = false;
+static bool periodicY = false;
+static float gravity = ACC_GRAVITY;
+static float restitution = RESTITUTION;
+static uint64_t randomSeed = 1;
+static float forcingAmplitude = 0.0f;
+static uint64_t stepIndex = 0;
+
+// Scratch buffers below live in the step arena and are only valid during updatePosition
+static Arena stepArena;
+static bool stepArenaReady = false;
+
+// Broadphase grid, counting-sorted particle indices per cell
+static int* cellStart = NULL;   // numCells + 2 offsets into cellEntries, the last cell holds particles outside
+static int* cellEntries = NULL; // particle indices grouped by cell
+static int* particleCell = NULL;
+static int gridCellsX = 1;
+static int gridCellsY = 1;
+static Circle* previousCircles = NULL; // state before collision resolution
+
+// Hierarchical block timestepping, 0 levels integrates everything with the global timestep
+static int timestepLevels = 0;
+static unsigned char* timestepBin = NULL;
+static int* binStart = NULL;            // timestepLevels + 2 offsets into binEntries
+static int* binEntries = NULL;          // particle indices sorted by bin, in index order within a bin
+
+// Multi-rate broadphase: the grid as linked cell lists, so a substep relinks only the particles it
+// moved instead of rebuilding the whole grid
+static int* cellHead = NULL;            // first particle of every cell and of the outside cell, -1 when empty
+static int* nextInCell = NULL;
+static int* previousInCell = NULL;
+static float* contactResponse = NULL;   // x and y shift, new x and y velocity per particle
+static atomic_uchar* contactTouched = NULL;
+static int* touchedList = NULL;         // inactive particles hit by active ones in this substep
+static atomic_int touchedCount;
+static long long particleUpdates = 0;
+
+// Optional per-step output of the derived fields, gathered in the step's own neighbour search
+static float* densityOutput = NULL;
+static float* pressureOutput = NULL;
+
+static LongRangeMode longRangeMode = LONG_RANGE_NONE;
+static float longRangeStrength = 0.0f;
+static float longRangeTheta = 0.5f;
+static QuadTree longRangeTree;
+static float* longRangeAcc = NULL; // x accelerations followed by y accelerations
+
+void setBoundarySDF(const SDFGrid* grid) {
+    boundarySDF = grid;
+}
+
+void setPeriodicBoundaries(bool wrapX, bool wrapY) {
+    periodicX = wrapX;
+    periodicY = wrapY;
+}
+
+void setGravity(float acceleration) {
+    gravity = acceleration;
+}
+
+void setRestitution(float coefficient) {
+    restitution = coefficient;
+}
+
+void setRandomSeed(uint64_t seed) {
+    randomSeed = seed;
+}
+
+void setRandomForcing(float amplitude) {
+    forcingAmplitude = amplitude;
+}
+
+void setStepIndex(uint64_t step) {
+    stepIndex = step;
+}
+
+void setTimestepBins(int levels) {
+    timestepLevels = levels < 0 ? 0 : (levels > MAX_TIMESTEP_LEVELS ? MAX_TIMESTEP_LEVELS : levels);
+}
+
+void setLongRangeForce(LongRangeMode mode, float strength, float theta) {
+    longRangeMode = mode;
+    longRangeStrength = mode == LONG_RANGE_COULOMB ? -fabsf(strength) : fabsf(strength);
+    longRangeTheta = theta;
+}
+
+void setDensityPressureOutput(float* density, float* pressure) {
+    densityOutput = density && pressure ? density : NULL;
+    pressureOutput = density && pressure ? pressure : NULL;
+}
+
+void resetPhysicsParameters(void) {
+    boundarySDF = NULL;
+    densityOutput = NULL;
+    pressureOutput = NULL;
+    periodicX = false;
+    periodicY = false;
+    gravity = ACC_GRAVITY;
+    restitution = RESTITUTION;
+    timestepLevels = 0;
+    longRangeMode = LONG_RANGE_NONE;
+    longRangeStrength = 0.0f;
+    longRangeTheta = 0.5f;
+    randomSeed = 1;
+    forcingAmplitude = 0.0f;
+    stepIndex = 0;
+}
+
+void getPhysicsParameters(PhysicsParameters* parameters) {
+    parameters->periodicX = periodicX;
+    parameters->periodicY = periodicY;
+    parameters->gravity = gravity;
+    parameters->restitution = restitution;
+    parameters->timestepLevels = timestepLevels;
+    parameters->longRangeMode = longRangeMode;
+    parameters->longRangeStrength = longRangeStrength;
+    parameters->longRangeTheta = longRangeTheta;
+    parameters->seed = randomSeed;
+    parameters->forcingAmplitude = forcingAmplitude;
+}
+
+// Shortest separation between two particles when an axis wraps around
+static void minimumImage(float* dx, float* dy) {
+    if (periodicX) *dx -= WINDOW_WIDTH * roundf(*dx / WINDOW_WIDTH);
+    if (periodicY) *dy -= WINDOW_HEIGHT * roundf(*dy / WINDOW_HEIGHT);
+}
 
 static bool checkCollision(float x1, float y1, float r1, float x2, float y2, float r2) {
     float dx = x2 - x1;
     float dy = y2 - y1;
+    minimumImage(&dx, &dy);
     float distanceSquared = dx * dx + dy * dy;
     float radiusSum = r1 + r2;
     return distanceSquared < radiusSum * radiusSum; // Check if distance is less than the sum of radii
 }
 
-static void resolveCollision(float* x1, float* y1, float* vx1, float* vy1, float r1,
-    float* x2, float* y2, float* vx2, float* vy2, float r2) {
-    float dx = *x2 - *x1;
-    float dy = *y2 - *y1;
+// One side of a collision: particle 1 moves half the overlap away from particle 2 and reflects its
+// velocity. Positions are read from before resolution, so each particle can resolve its own
+// contacts independently of the others, and the pair ends up handled symmetrically.
+static void resolveCollision(float x1, float y1, float r1, float x2, float y2, float r2,
+    float* xShift, float* yShift, float* vx1, float* vy1) {
+    float dx = x2 - x1;
+    float dy = y2 - y1;
+    minimumImage(&dx, &dy);
     float distance = sqrtf(dx * dx + dy * dy);
 
     if (distance == 0.0f) return; // Avoid division by zero
@@ -31,60 +180,648 @@ static void resolveCollision(float* x1, float* y1, float* vx1, float* vy1, float
 
     // Separate the circles
     float overlap = r1 + r2 - distance;
-    *x1 -= nx * overlap / 2.0f;
-    *y1 -= ny * overlap / 2.0f;
-    *x2 += nx * overlap / 2.0f;
-    *y2 += ny * overlap / 2.0f;
+    *xShift -= nx * overlap / 2.0f;
+    *yShift -= ny * overlap / 2.0f;
 
-    // Reflect velocities (simple collision response)
+    // Reflect velocity (simple collision response)
     float dotProduct1 = *vx1 * nx + *vy1 * ny;
-    float dotProduct2 = *vx2 * nx + *vy2 * ny;
 
-    *vx1 -= 1.96f * dotProduct1 * nx;
-    *vy1 -= 1.96f * dotProduct1 * ny;
-    *vx2 -= 1.96f * dotProduct2 * nx;
-    *vy2 -= 1.96f * dotProduct2 * ny;
+    *vx1 -= (1.0f + restitution) * dotProduct1 * nx;
+    *vy1 -= (1.0f + restitution) * dotProduct1 * ny;
 }
 
-void updatePosition(Circle* circles, int NumCircles, float timestep) {//(float* xPos,float* yPos,float* xVelocity,float* yVelocity, float timestep){
-    //*xPos = 0.5f * sinf(time);
-    //*yPos = 0.5f * cosf(time);
+// Push a circle out of the SDF boundary and reflect its velocity along the contact normal
+static void resolveBoundaryContact(Circle* c) {
+    float gx, gy;
+    float distance = SDFGrid_Sample(boundarySDF, c->xPos, c->yPos, &gx, &gy);
+    if (distance >= c->radius) return;
+
+    float gradientLength = sqrtf(gx * gx + gy * gy);
+    if (gradientLength == 0.0f) return;
+    float nx = gx / gradientLength;
+    float ny = gy / gradientLength;
+
+    float penetration = c->radius - distance;
+    c->xPos += nx * penetration;
+    c->yPos += ny * penetration;
+
+    float normalVelocity = c->xVelocity * nx + c->yVelocity * ny;
+    if (normalVelocity < 0.0f) {
+        c->xVelocity -= 2.0f * normalVelocity * nx;
+        c->yVelocity -= 2.0f * normalVelocity * ny;
+    }
+}
+
+// Position moved into [minimum, minimum + size) by whole periods
+static float wrapCoordinate(float position, float minimum, float size) {
+    float wrapped = position - size * floorf((position - minimum) / size);
+    return wrapped < minimum + size ? wrapped : minimum;
+}
+
+// Reflect off the window walls, or wrap around on periodic axes
+static void applyWindowBoundaries(Circle* c1) {
+    if (periodicY) {
+        c1->yPos = wrapCoordinate(c1->yPos, WINDOW_BOTTOM, WINDOW_HEIGHT);
+    } else if (c1->yPos <= WINDOW_BOTTOM) {
+        c1->yPos = WINDOW_BOTTOM;
+        c1->yVelocity = -c1->yVelocity;
+    } else if (c1->yPos >= WINDOW_TOP) {
+        c1->yPos = WINDOW_TOP;
+        c1->yVelocity = -c1->yVelocity;
+    }
+
+    if (periodicX) {
+        c1->xPos = wrapCoordinate(c1->xPos, WINDOW_LEFT, WINDOW_WIDTH);
+    } else if (c1->xPos <= WINDOW_LEFT) {
+        c1->xPos = WINDOW_LEFT;
+        c1->xVelocity = -c1->xVelocity;
+    } else if (c1->xPos >= WINDOW_RIGHT) {
+        c1->xPos = WINDOW_RIGHT;
+        c1->xVelocity = -c1->xVelocity;
+    }
+}
+
+// A contact correction can push a particle past a wall or the periodic seam, put it back on the
+// wall (the next integration reflects its velocity) or wrap it
+static void confineToDomain(Circle* c) {
+    if (periodicX) c->xPos = wrapCoordinate(c->xPos, WINDOW_LEFT, WINDOW_WIDTH);
+    else c->xPos = c->xPos < WINDOW_LEFT ? WINDOW_LEFT : (c->xPos > WINDOW_RIGHT ? WINDOW_RIGHT : c->xPos);
+    if (periodicY) c->yPos = wrapCoordinate(c->yPos, WINDOW_BOTTOM, WINDOW_HEIGHT);
+    else c->yPos = c->yPos < WINDOW_BOTTOM ? WINDOW_BOTTOM : (c->yPos > WINDOW_TOP ? WINDOW_TOP : c->yPos);
+}
+
+// Cell along one axis, -1 outside the domain. Only a position exactly on the upper wall is
+// moved into the last cell, anything further out is not folded into the edge cells.
+static int cellCoordinate(float position, float minimum, float cellSize, int numCells) {
+    float offset = (position - minimum) / cellSize;
+    if (!(offset >= 0.0f && offset <= numCells)) return -1;
+    int cell = (int)offset;
+    return cell < numCells ? cell : numCells - 1;
+}
+
+// Grid cell of a position, or the extra cell numCells for positions outside the domain
+static int gridCell(float x, float y, float cellWidth, float cellHeight) {
+    int cx = cellCoordinate(x, WINDOW_LEFT, cellWidth, gridCellsX);
+    int cy = cellCoordinate(y, WINDOW_BOTTOM, cellHeight, gridCellsY);
+    return cx < 0 || cy < 0 ? gridCellsX * gridCellsY : cy * gridCellsX + cx;
+}
+
+// Neighbouring cell indices along one axis; periodic axes wrap to the opposite side (ghost cells)
+static int neighbourCells(int cell, int numCells, bool periodic, int* neighbours) {
+    if (periodic && numCells < 3) {
+        for (int k = 0; k < numCells; k++) neighbours[k] = k;
+        return numCells;
+    }
+    int count = 0;
+    for (int offset = -1; offset <= 1; offset++) {
+        int n = cell + offset;
+        if (periodic) n = (n + numCells) % numCells;
+        else if (n < 0 || n >= numCells) continue;
+        neighbours[count++] = n;
+    }
+    return count;
+}
+
+// Cells around a particle's cell on both axes, none for a particle outside the domain, which
+// then has no contacts until its next integration brings it back
+static void neighbourhood(int cell, int* neighboursX, int* countX, int* neighboursY, int* countY) {
+    if (cell >= gridCellsX * gridCellsY) {
+        *countX = *countY = 0;
+        return;
+    }
+    *countX = neighbourCells(cell % gridCellsX, gridCellsX, periodicX, neighboursX);
+    *countY = neighbourCells(cell / gridCellsX, gridCellsY, periodicY, neighboursY);
+}
+
+// Barnes-Hut accelerations from the particle positions at the start of the step, across the seam
+// of periodic axes by the nearest image like the contacts
+static void computeLongRangeForces(const Circle* circles, int numCircles) {
+    QuadTree_Build(&longRangeTree, circles, numCircles);
+    QuadTree_Accelerations(&longRangeTree, circles, numCircles, longRangeStrength, longRangeTheta,
+                           periodicX ? WINDOW_WIDTH : 0.0f, periodicY ? WINDOW_HEIGHT : 0.0f,
+                           longRangeAcc, longRangeAcc + numCircles);
+}
+
+static void integrateParticle(Circle* c1, int index, int numCircles, float timestep) {
+    if (longRangeMode != LONG_RANGE_NONE) {
+        c1->xVelocity += longRangeAcc[index] * timestep;
+        c1->yVelocity += longRangeAcc[numCircles + index] * timestep;
+    }
+
+    c1->xPos += c1->xVelocity * timestep;
+    c1->yPos += c1->yVelocity * timestep;
+
+    c1->yVelocity -= gravity * timestep; //include gravity
+
+    applyWindowBoundaries(c1);
+
+    if (boundarySDF) {
+        resolveBoundaryContact(c1);
+        confineToDomain(c1);
+    }
+}
+
+// Arguments shared by the parallel stages of one (sub)step
+typedef struct {
+    Circle* circles;
+    int numCircles;
+    float timestep;
+    const int* particles;      // multi-rate: indices the stage visits
+    int firstLevel;            // multi-rate: lowest bin active in the substep
+    float cellWidth, cellHeight;
+    float* density;            // output fields
+    float* pressure;
+} StepStage;
+
+// Uniform kicks scaled to unit variance, so the velocity random walk has variance amplitude^2 * time
+static void forcingRange(int begin, int end, void* context) {
+    StepStage* stage = context;
+    float kick = forcingAmplitude * sqrtf(3.0f * stage->timestep);
+    for (int i = begin; i < end; i++) {
+        stage->circles[i].xVelocity += kick * Rng_Signed(randomSeed, RNG_STREAM_FORCING_X, (uint64_t)i, stepIndex);
+        stage->circles[i].yVelocity += kick * Rng_Signed(randomSeed, RNG_STREAM_FORCING_Y, (uint64_t)i, stepIndex);
+    }
+}
+
+static void integrateRange(int begin, int end, void* context) {
+    StepStage* stage = context;
+    for (int i = begin; i < end; i++) {
+        integrateParticle(&stage->circles[i], i, stage->numCircles, stage->timestep);
+    }
+}
+
+// Substep s advances every bin whose period 2^(levels - k) divides s, so bin k is integrated 2^k
+// times with timestep / 2^k. The bins that do are always those from some level up, a suffix of
+// binEntries.
+static int firstActiveLevel(int substep) {
+    if (substep == 0) return 0;
+    int trailingZeros = 0;
+    while ((substep & 1) == 0) {
+        substep >>= 1;
+        trailingZeros++;
+    }
+    return timestepLevels - trailingZeros;
+}
+
+static void integrateActiveRange(int begin, int end, void* context) {
+    StepStage* stage = context;
+    for (int k = begin; k < end; k++) {
+        int i = stage->particles[k];
+        integrateParticle(&stage->circles[i], i, stage->numCircles, ldexpf(stage->timestep, -timestepBin[i]));
+    }
+}
+
+static void cellIndexRange(int begin, int end, void* context) {
+    StepStage* stage = context;
+    for (int i = begin; i < end; i++) {
+        particleCell[i] = gridCell(stage->circles[i].xPos, stage->circles[i].yPos, stage->cellWidth, stage->cellHeight);
+    }
+}
+
+// Cells at least one diameter wide so only adjacent cells can collide, sized once per step
+static void configureGrid(const Circle* circles, int numCircles) {
+    float maxRadius = 0.0f;
+    for (int i = 0; i < numCircles; i++) {
+        if (circles[i].radius > maxRadius) maxRadius = circles[i].radius;
+    }
 
-    //_includeGravity(yPos, yVelocity,timestep);
-    for (int i = 0; i < NumCircles; i++) {
-        Circle* c1 = &circles[i];
+    float cellSize = fmaxf(2.0f * maxRadius, WINDOW_WIDTH / MAX_GRID_CELLS);
+    gridCellsX = (int)(WINDOW_WIDTH / cellSize);
+    gridCellsY = (int)(WINDOW_HEIGHT / cellSize);
+    if (gridCellsX < 1) gridCellsX = 1;
+    if (gridCellsY < 1) gridCellsY = 1;
+}
+
+// Bin particles into the grid cells
+static void buildGrid(const Circle* circles, int numCircles) {
+    int numCells = gridCellsX * gridCellsY;
+    StepStage stage = { .circles = (Circle*)circles, .numCircles = numCircles,
+                        .cellWidth = WINDOW_WIDTH / gridCellsX, .cellHeight = WINDOW_HEIGHT / gridCellsY };
+    JobSystem_ParallelFor(numCircles, PARTICLES_PER_JOB, cellIndexRange, &stage);
+
+    // Counting sort keeps particles of a cell in index order, so the contact order is fixed
+    for (int c = 0; c <= numCells + 1; c++) cellStart[c] = 0;
+    for (int i = 0; i < numCircles; i++) {
+        cellStart[particleCell[i] + 1]++;
+    }
+    for (int c = 0; c <= numCells; c++) cellStart[c + 1] += cellStart[c];
+    for (int i = 0; i < numCircles; i++) {
+        cellEntries[cellStart[particleCell[i]]++] = i;
+    }
+    for (int c = numCells + 1; c > 0; c--) cellStart[c] = cellStart[c - 1];
+    cellStart[0] = 0;
+}
 
-        c1->xPos += c1->xVelocity * timestep;
-        c1->yPos += c1->yVelocity * timestep;
+// 2D poly6 kernel with support h = the cell size, with particle mass taken as its area so the
+// density is a local area fraction. Pressure sums the contact overlaps per unit of perimeter.
+// The sums run over the grid neighbourhood, the particle itself included.
+static void accumulateFields(const Circle* c1, const Circle* c2, bool self, float hSquared,
+                             float* density, float* overlap) {
+    float dx = c2->xPos - c1->xPos;
+    float dy = c2->yPos - c1->yPos;
+    minimumImage(&dx, &dy);
+    float distanceSquared = dx * dx + dy * dy;
+    if (distanceSquared < hSquared) {
+        float w = hSquared - distanceSquared;
+        *density += 3.14159265f * c2->radius * c2->radius * w * w * w;
+    }
+    float gap = c1->radius + c2->radius - sqrtf(distanceSquared);
+    if (!self && gap > 0.0f) *overlap += gap;
+}
 
-        c1->yVelocity -= ACC_GRAVITY * timestep; //include gravity
+static void storeFields(const StepStage* stage, int i, float radius, float density, float overlap) {
+    float hSquared = fminf(stage->cellWidth, stage->cellHeight);
+    hSquared *= hSquared;
+    float normalisation = 4.0f / (3.14159265f * hSquared * hSquared * hSquared * hSquared);
+    stage->density[i] = density * normalisation;
+    stage->pressure[i] = radius > 0.0f ? overlap / (2.0f * 3.14159265f * radius) : 0.0f;
+}
 
+// Each particle gathers the response from every touching neighbour, reading positions from the
+// snapshot taken before resolution and writing only itself. With field outputs set the same
+// walk gathers density and pressure of that snapshot.
+static void resolveRange(int begin, int end, void* context) {
+    StepStage* stage = context;
+    bool gatherFields = stage->density != NULL;
+    float h = fminf(stage->cellWidth, stage->cellHeight);
+    for (int i = begin; i < end; i++) {
+        const Circle* c1 = &previousCircles[i];
+        Circle* out = &stage->circles[i];
+        float xShift = 0.0f, yShift = 0.0f;
+        float density = 0.0f, overlap = 0.0f;
+        int neighboursX[3], neighboursY[3], countX, countY;
+        neighbourhood(particleCell[i], neighboursX, &countX, neighboursY, &countY);
+        if (gatherFields) accumulateFields(c1, c1, true, h * h, &density, &overlap);
 
-        if (c1->yPos <= WINDOW_BOTTOM) {
-            c1->yPos = WINDOW_BOTTOM;
-            c1->yVelocity = -c1->yVelocity;
-        } else if (c1->yPos >= WINDOW_TOP) {
-            c1->yPos = WINDOW_TOP;
-            c1->yVelocity = -c1->yVelocity;
+        for (int ny = 0; ny < countY; ny++) {
+            for (int nx = 0; nx < countX; nx++) {
+                int cell = neighboursY[ny] * gridCellsX + neighboursX[nx];
+                for (int e = cellStart[cell]; e < cellStart[cell + 1]; e++) {
+                    int j = cellEntries[e];
+                    if (j == i) continue;
+                    const Circle* c2 = &previousCircles[j];
+                    if (gatherFields) accumulateFields(c1, c2, false, h * h, &density, &overlap);
+                    if (checkCollision(c1->xPos, c1->yPos, c1->radius, c2->xPos, c2->yPos, c2->radius)) {
+                        resolveCollision(c1->xPos, c1->yPos, c1->radius, c2->xPos, c2->yPos, c2->radius,
+                                         &xShift, &yShift, &out->xVelocity, &out->yVelocity);
+                    }
+                }
+            }
         }
+        out->xPos += xShift;
+        out->yPos += yShift;
+        confineToDomain(out);
+        if (gatherFields) storeFields(stage, i, c1->radius, density, overlap);
+    }
+}
+
+// Resolve every touching pair
+static void resolveCollisions(Circle* circles, int numCircles) {
+    memcpy(previousCircles, circles, sizeof(Circle) * numCircles);
+
+    StepStage stage = { .circles = circles, .numCircles = numCircles,
+                        .cellWidth = WINDOW_WIDTH / gridCellsX, .cellHeight = WINDOW_HEIGHT / gridCellsY,
+                        .density = densityOutput, .pressure = pressureOutput };
+    JobSystem_ParallelFor(numCircles, PARTICLES_PER_JOB, resolveRange, &stage);
+}
+
+// Fields of computeDensityPressure over the CSR grid
+static void densityRange(int begin, int end, void* context) {
+    StepStage* stage = context;
+    float h = fminf(stage->cellWidth, stage->cellHeight);
+    for (int i = begin; i < end; i++) {
+        const Circle* c1 = &stage->circles[i];
+        float density = 0.0f, overlap = 0.0f;
+        int neighboursX[3], neighboursY[3], countX, countY;
+        neighbourhood(particleCell[i], neighboursX, &countX, neighboursY, &countY);
 
-        if (c1->xPos <= WINDOW_LEFT) {
-            c1->xPos = WINDOW_LEFT;
-            c1->xVelocity = -c1->xVelocity;
-        } else if (c1->xPos >= WINDOW_RIGHT) {
-            c1->xPos = WINDOW_RIGHT;
-            c1->xVelocity = -c1->xVelocity;
+        for (int ny = 0; ny < countY; ny++) {
+            for (int nx = 0; nx < countX; nx++) {
+                int cell = neighboursY[ny] * gridCellsX + neighboursX[nx];
+                for (int e = cellStart[cell]; e < cellStart[cell + 1]; e++) {
+                    int j = cellEntries[e];
+                    accumulateFields(c1, &stage->circles[j], j == i, h * h, &density, &overlap);
+                }
+            }
         }
+        storeFields(stage, i, c1->radius, density, overlap);
+    }
+}
+
+// Same fields over the multi-rate cell lists, which are current at the end of a step
+static void densityListRange(int begin, int end, void* context) {
+    StepStage* stage = context;
+    float h = fminf(stage->cellWidth, stage->cellHeight);
+    for (int i = begin; i < end; i++) {
+        const Circle* c1 = &stage->circles[i];
+        float density = 0.0f, overlap = 0.0f;
+        int neighboursX[3], neighboursY[3], countX, countY;
+        neighbourhood(particleCell[i], neighboursX, &countX, neighboursY, &countY);
 
-        for (int j = i + 1; j < NumCircles; j++) {
-            Circle* c2 = &circles[j];
-            if (checkCollision(c1->xPos, c1->yPos, c1->radius, c2->xPos, c2->yPos, c2->radius)) {
-                resolveCollision(&c1->xPos, &c1->yPos, &c1->xVelocity, &c1->yVelocity, c1->radius,
-                                 &c2->xPos, &c2->yPos, &c2->xVelocity, &c2->yVelocity, c2->radius);
+        for (int ny = 0; ny < countY; ny++) {
+            for (int nx = 0; nx < countX; nx++) {
+                for (int j = cellHead[neighboursY[ny] * gridCellsX + neighboursX[nx]]; j >= 0; j = nextInCell[j]) {
+                    accumulateFields(c1, &stage->circles[j], j == i, h * h, &density, &overlap);
+                }
             }
         }
+        storeFields(stage, i, c1->radius, density, overlap);
     }
+}
+
+// Power-of-two bin per particle: bin k steps with timestep / 2^k, the smallest k that
+// keeps the particle from travelling more than COURANT_FRACTION of its radius per substep
+static void assignTimestepBins(int begin, int end, void* context) {
+    StepStage* stage = context;
+    for (int i = begin; i < end; i++) {
+        const Circle* c = &stage->circles[i];
+        float speed = sqrtf(c->xVelocity * c->xVelocity + c->yVelocity * c->yVelocity);
+        float travel = speed * stage->timestep;
+        float limit = COURANT_FRACTION * c->radius;
+        int level = 0;
+        while (level < timestepLevels && travel > limit) {
+            travel *= 0.5f;
+            level++;
+        }
+        timestepBin[i] = (unsigned char)level;
+    }
+}
+
+static int particleCellIndex(const Circle* c) {
+    return gridCell(c->xPos, c->yPos, WINDOW_WIDTH / gridCellsX, WINDOW_HEIGHT / gridCellsY);
+}
+
+static void linkParticle(int i, int cell) {
+    particleCell[i] = cell;
+    previousInCell[i] = -1;
+    nextInCell[i] = cellHead[cell];
+    if (cellHead[cell] >= 0) previousInCell[cellHead[cell]] = i;
+    cellHead[cell] = i;
+}
+
+static void unlinkParticle(int i) {
+    if (previousInCell[i] >= 0) nextInCell[previousInCell[i]] = nextInCell[i];
+    else cellHead[particleCell[i]] = nextInCell[i];
+    if (nextInCell[i] >= 0) previousInCell[nextInCell[i]] = previousInCell[i];
+}
+
+// Move the listed particles to the cells of their current positions, in list order
+static void relinkParticles(const Circle* circles, const int* particles, int count) {
+    for (int k = 0; k < count; k++) {
+        int i = particles[k];
+        int cell = particleCellIndex(&circles[i]);
+        if (cell != particleCell[i]) {
+            unlinkParticle(i);
+            linkParticle(i, cell);
+        }
+    }
+}
+
+// Response of each listed particle to its contacts in this substep: active particles respond to
+// every neighbour, inactive ones only to active neighbours, as in resolveRange. Positions are only
+// read, the responses go to contactResponse, so every particle can be handled at once. Inactive
+// particles hit by an active one are collected in touchedList for a second pass.
+static void contactRange(int begin, int end, void* context) {
+    StepStage* stage = context;
+    const Circle* circles = stage->circles;
+    for (int k = begin; k < end; k++) {
+        int i = stage->particles[k];
+        const Circle* c1 = &circles[i];
+        bool activeI = timestepBin[i] >= stage->firstLevel;
+        float* response = &contactResponse[4 * (size_t)i];
+        response[0] = 0.0f;
+        response[1] = 0.0f;
+        response[2] = c1->xVelocity;
+        response[3] = c1->yVelocity;
+        int neighboursX[3], neighboursY[3], countX, countY;
+        neighbourhood(particleCell[i], neighboursX, &countX, neighboursY, &countY);
+
+        for (int ny = 0; ny < countY; ny++) {
+            for (int nx = 0; nx < countX; nx++) {
+                for (int j = cellHead[neighboursY[ny] * gridCellsX + neighboursX[nx]]; j >= 0; j = nextInCell[j]) {
+                    bool activeJ = timestepBin[j] >= stage->firstLevel;
+                    if (j == i || (!activeI && !activeJ)) continue;
+                    const Circle* c2 = &circles[j];
+                    if (!checkCollision(c1->xPos, c1->yPos, c1->radius, c2->xPos, c2->yPos, c2->radius)) continue;
+                    resolveCollision(c1->xPos, c1->yPos, c1->radius, c2->xPos, c2->yPos, c2->radius,
+                                     &response[0], &response[1], &response[2], &response[3]);
+                    if (!activeJ && !atomic_exchange_explicit(&contactTouched[j], 1, memory_order_relaxed)) {
+                        touchedList[atomic_fetch_add_explicit(&touchedCount, 1, memory_order_relaxed)] = j;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void applyResponseRange(int begin, int end, void* context) {
+    StepStage* stage = context;
+    for (int k = begin; k < end; k++) {
+        int i = stage->particles[k];
+        const float* response = &contactResponse[4 * (size_t)i];
+        Circle* c = &stage->circles[i];
+        c->xPos += response[0];
+        c->yPos += response[1];
+        c->xVelocity = response[2];
+        c->yVelocity = response[3];
+        confineToDomain(c);
+        atomic_store_explicit(&contactTouched[i], 0, memory_order_relaxed);
+    }
+}
 
+static int compareIndices(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
 }
 
+// Resolve the contacts of the listed active particles, and of the inactive particles they hit
+static void resolveActiveContacts(StepStage* stage, int count) {
+    const int* active = stage->particles;
+    atomic_store_explicit(&touchedCount, 0, memory_order_relaxed);
+    JobSystem_ParallelFor(count, PARTICLES_PER_JOB, contactRange, stage);
 
+    // The touched list fills in whatever order the workers get there, sort it so the cell lists
+    // are relinked the same way every run
+    int touched = atomic_load_explicit(&touchedCount, memory_order_relaxed);
+    qsort(touchedList, (size_t)touched, sizeof(int), compareIndices);
+    stage->particles = touchedList;
+    JobSystem_ParallelFor(touched, PARTICLES_PER_JOB, contactRange, stage);
+
+    JobSystem_ParallelFor(touched, PARTICLES_PER_JOB, applyResponseRange, stage);
+    stage->particles = active;
+    JobSystem_ParallelFor(count, PARTICLES_PER_JOB, applyResponseRange, stage);
+    relinkParticles(stage->circles, active, count);
+    relinkParticles(stage->circles, touchedList, touched);
+    particleUpdates += 2 * (long long)count + touched;
+}
+
+// The grid is linked once per step and every substep only visits its active bins, so a step
+// costs about sum over bins of (particles in bin k) * 2^k rather than 2^levels full passes
+static void updateMultiRate(Circle* circles, int numCircles, float timestep) {
+    StepStage stage = { .circles = circles, .numCircles = numCircles, .timestep = timestep };
+    JobSystem_ParallelFor(numCircles, PARTICLES_PER_JOB, assignTimestepBins, &stage);
+
+    // Counting sort by bin, and cell lists in index order
+    for (int level = 0; level <= timestepLevels + 1; level++) binStart[level] = 0;
+    for (int i = 0; i < numCircles; i++) binStart[timestepBin[i] + 1]++;
+    for (int level = 0; level <= timestepLevels; level++) binStart[level + 1] += binStart[level];
+    for (int i = 0; i < numCircles; i++) binEntries[binStart[timestepBin[i]]++] = i;
+    for (int level = timestepLevels + 1; level > 0; level--) binStart[level] = binStart[level - 1];
+    binStart[0] = 0;
+    for (int c = 0; c <= gridCellsX * gridCellsY; c++) cellHead[c] = -1;
+    for (int i = numCircles - 1; i >= 0; i--) linkParticle(i, particleCellIndex(&circles[i]));
+    memset(contactTouched, 0, (size_t)numCircles);
+
+    int substeps = 1 << timestepLevels;
+    for (int s = 0; s < substeps; s++) {
+        stage.firstLevel = firstActiveLevel(s);
+        int first = binStart[stage.firstLevel];
+        int count = numCircles - first;
+        stage.particles = binEntries + first;
+        JobSystem_ParallelFor(count, PARTICLES_PER_JOB, integrateActiveRange, &stage);
+        relinkParticles(circles, stage.particles, count);
+        resolveActiveContacts(&stage, count);
+    }
+
+    if (densityOutput) {
+        StepStage fields = { .circles = circles, .numCircles = numCircles,
+                             .cellWidth = WINDOW_WIDTH / gridCellsX, .cellHeight = WINDOW_HEIGHT / gridCellsY,
+                             .density = densityOutput, .pressure = pressureOutput };
+        JobSystem_ParallelFor(numCircles, PARTICLES_PER_JOB, densityListRange, &fields);
+    }
+}
+
+// Carve this step's scratch buffers out of the step arena, nothing here touches the heap once warm
+static void allocateStepScratch(const Circle* circles, int numCircles) {
+    if (!stepArenaReady) {
+        if (Arena_Init(&stepArena, STEP_ARENA_CAPACITY) != 0) exit(EXIT_FAILURE);
+        stepArenaReady = true;
+    }
+    Arena_Reset(&stepArena);
+
+    configureGrid(circles, numCircles);
+    int numCells = gridCellsX * gridCellsY;
+    cellStart = ARENA_ARRAY(&stepArena, int, numCells + 2);
+    cellEntries = ARENA_ARRAY(&stepArena, int, numCircles);
+    particleCell = ARENA_ARRAY(&stepArena, int, numCircles);
+    previousCircles = ARENA_ARRAY(&stepArena, Circle, numCircles);
+    bool ok = cellStart && cellEntries && particleCell && previousCircles;
+    if (timestepLevels > 0) {
+        timestepBin = ARENA_ARRAY(&stepArena, unsigned char, numCircles);
+        binStart = ARENA_ARRAY(&stepArena, int, timestepLevels + 2);
+        binEntries = ARENA_ARRAY(&stepArena, int, numCircles);
+        cellHead = ARENA_ARRAY(&stepArena, int, numCells + 1);
+        nextInCell = ARENA_ARRAY(&stepArena, int, numCircles);
+        previousInCell = ARENA_ARRAY(&stepArena, int, numCircles);
+        contactResponse = ARENA_ARRAY(&stepArena, float, 4 * (size_t)numCircles);
+        contactTouched = ARENA_ARRAY(&stepArena, atomic_uchar, numCircles);
+        touchedList = ARENA_ARRAY(&stepArena, int, numCircles);
+        ok = ok && timestepBin && binStart && binEntries && cellHead && nextInCell && previousInCell &&
+             contactResponse && contactTouched && touchedList;
+    }
+    if (longRangeMode != LONG_RANGE_NONE) {
+        longRangeAcc = ARENA_ARRAY(&stepArena, float, 2 * numCircles);
+        ok = ok && longRangeAcc;
+    }
+    if (!ok) {
+        fprintf(stderr, "Step arena of %zu bytes is too small for %d particles\n", stepArena.capacity, numCircles);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void computeDensityPressure(const Circle* circles, int numCircles, float* density, float* pressure) {
+    allocateStepScratch(circles, numCircles);
+    buildGrid(circles, numCircles);
+    StepStage stage = { .circles = (Circle*)circles, .numCircles = numCircles,
+                        .cellWidth = WINDOW_WIDTH / gridCellsX, .cellHeight = WINDOW_HEIGHT / gridCellsY,
+                        .density = density, .pressure = pressure };
+    JobSystem_ParallelFor(numCircles, PARTICLES_PER_JOB, densityRange, &stage);
+}
+
+void getPhysicsStats(PhysicsStats* stats) {
+    stats->arenaCapacity = stepArena.capacity;
+    stats->arenaBytesUsed = stepArena.offset;
+    stats->arenaPeakBytes = stepArena.peak;
+    stats->particleUpdates = particleUpdates;
+}
+
+typedef struct {
+    unsigned char* memory;
+    size_t size;
+} TouchContext;
+
+// Zero whole huge pages per job, smaller ranges would have several workers faulting one page
+static void firstTouchRange(int begin, int end, void* context) {
+    const TouchContext* touch = context;
+    size_t first = (size_t)begin * HUGE_PAGE_SIZE;
+    size_t last = (size_t)end * HUGE_PAGE_SIZE;
+    if (last > touch->size) last = touch->size;
+    memset(touch->memory + first, 0, last - first);
+}
+
+Circle* allocateCircles(int numCircles) {
+    Circle* circles = HugePages_Alloc(sizeof(Circle) * (size_t)numCircles);
+    if (!circles) {
+        fprintf(stderr, "Failed to allocate memory for %d particles\n", numCircles);
+        return NULL;
+    }
+    TouchContext touch = { (unsigned char*)circles, sizeof(Circle) * (size_t)numCircles };
+    int numPages = (int)((touch.size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE);
+    JobSystem_ParallelFor(numPages, 1, firstTouchRange, &touch);
+    return circles;
+}
+
+void freeCircles(Circle* circles, int numCircles) {
+    HugePages_Free(circles, sizeof(Circle) * (size_t)numCircles);
+}
+
+void updatePosition(Circle* circles, int NumCircles, float timestep) {//(float* xPos,float* yPos,float* xVelocity,float* yVelocity, float timestep){
+    allocateStepScratch(circles, NumCircles);
+
+    if (longRangeMode != LONG_RANGE_NONE) {
+        computeLongRangeForces(circles, NumCircles);
+    }
+
+    StepStage stage = { .circles = circles, .numCircles = NumCircles, .timestep = timestep };
+    if (forcingAmplitude != 0.0f) {
+        JobSystem_ParallelFor(NumCircles, PARTICLES_PER_JOB, forcingRange, &stage);
+    }
+
+    if (timestepLevels > 0) {
+        updateMultiRate(circles, NumCircles, timestep);
+    } else {
+        JobSystem_ParallelFor(NumCircles, PARTICLES_PER_JOB, integrateRange, &stage);
+        buildGrid(circles, NumCircles);
+        resolveCollisions(circles, NumCircles);
+        particleUpdates += 2 * (long long)NumCircles;
+    }
+    stepIndex++;
+}
+
+void latticePosition(int index, int count, int columns, float spacing, float* x, float* y) {
+    int rows = (count + columns - 1) / columns;
+    if (rows > columns) {
+        columns = (int)ceilf(sqrtf((float)count));
+        rows = (count + columns - 1) / columns;
+    }
+    int span = columns > rows ? columns - 1 : rows - 1;
+    if (span * spacing > WINDOW_WIDTH) spacing = WINDOW_WIDTH / span;
+    float width = (columns - 1) * spacing;
+    float height = (rows - 1) * spacing;
+    float offset = (count / columns) * spacing * 2;
+    float left = fminf(fmaxf(-offset, WINDOW_LEFT), WINDOW_RIGHT - width);
+    float bottom = fminf(0.0f, WINDOW_TOP - height);
+    *x = left + (index % columns) * spacing;
+    *y = bottom + (index / columns) * spacing;
+}
+
+uint64_t hashCircles(const Circle* circles, int numCircles) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < numCircles; i++) {
+        float state[4] = { circles[i].xPos, circles[i].yPos, circles[i].xVelocity, circles[i].yVelocity };
+        const unsigned char* bytes = (const unsigned char*)state;
+        for (size_t b = 0; b < sizeof(state); b++) {
+            hash = (hash ^ bytes[b]) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
@@ -1,5 +1,103 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
 #include <stdio.h>
 #include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include "circle.h"
+#include "sdf.h"
+
+typedef enum {
+    LONG_RANGE_NONE,
+    LONG_RANGE_GRAVITY,  // mutual attraction
+    LONG_RANGE_COULOMB   // mutual repulsion of like charges
+} LongRangeMode;
+
+// Memory use of the per-step scratch arena, the peak tells how large the arena must be, and the
+// work the steps did
+typedef struct {
+    size_t arenaCapacity;
+    size_t arenaBytesUsed;   // by the most recent step
+    size_t arenaPeakBytes;   // highest use by any step so far
+    long long particleUpdates;   // particles integrated plus particles resolved, over all steps
+} PhysicsStats;
+
+// Current solver settings, as made by the setters below
+typedef struct {
+    bool periodicX, periodicY;
+    float gravity;
+    float restitution;
+    int timestepLevels;
+    LongRangeMode longRangeMode;
+    float longRangeStrength;   // negative for repulsion
+    float longRangeTheta;
+    uint64_t seed;
+    float forcingAmplitude;
+} PhysicsParameters;
+
+void updatePosition(Circle* circles, int numCircles, float timestep);//(float* xPos, float* yPos, float* xVelocity, float* yVelocity,float time);
+
+// Collide particles against an arbitrary boundary in addition to the window walls, NULL disables it
+void setBoundarySDF(const SDFGrid* grid);
+
+// Wrap particles around the window on the given axes instead of reflecting them off the walls
+void setPeriodicBoundaries(bool wrapX, bool wrapY);
+
+// Downward acceleration, 1 by default
+void setGravity(float acceleration);
+
+// Fraction of the normal velocity kept in a particle contact, 0.96 by default
+void setRestitution(float coefficient);
+
+// Split each step into up to 2^levels substeps, particles only advance in the substeps of their
+// power-of-two timestep bin (chosen from speed and radius). 0 uses one global timestep.
+void setTimestepBins(int levels);
+
+// Pairwise 1/r^2 force between all particles via a Barnes-Hut quadtree with opening angle theta
+void setLongRangeForce(LongRangeMode mode, float strength, float theta);
+
+// Seed of every random number the solver draws, see rng.h
+void setRandomSeed(uint64_t seed);
+
+// White-noise acceleration: each step adds a random velocity kick of variance amplitude^2 * timestep
+// per axis, keyed by particle index and step index. 0 (the default) disables it.
+void setRandomForcing(float amplitude);
+
+// Index of the next step, the counter random forcing is keyed by. It advances once per
+// updatePosition call, so a restart has to set it to the step of its checkpoint.
+void setStepIndex(uint64_t step);
+
+void getPhysicsParameters(PhysicsParameters* parameters);
+
+// Back to the defaults of every setter above, with no boundary SDF and the step index at 0
+void resetPhysicsParameters(void);
+
+// Start position of particle index in a lattice of count particles: rows of the given number of
+// columns going up from y = 0, shifted left by twice the row count in spacings. Blocks taller than
+// wide get about sqrt(count) columns instead, the spacing shrinks until the block fits the domain,
+// and the block is moved inside the walls where the shift or the height would take it out.
+void latticePosition(int index, int count, int columns, float spacing, float* x, float* y);
+
+// FNV-1a over the position and velocity bits, equal hashes mean bit-identical states
+uint64_t hashCircles(const Circle* circles, int numCircles);
+
+void getPhysicsStats(PhysicsStats* stats);
+
+// Derived output fields per particle: kernel-weighted local area fraction, and summed contact overlap
+// per unit of perimeter as a pressure. Shares the solver scratch, so call it between steps.
+void computeDensityPressure(const Circle* circles, int numCircles, float* density, float* pressure);
+
+// Have every step also write the fields of computeDensityPressure for its particles, gathered in
+// the step's own neighbour search instead of a separate grid rebuild. Single-rate steps give the
+// fields of the state before their contact correction, multi-rate steps those of the final state.
+// NULL for either array stops it.
+void setDensityPressureOutput(float* density, float* pressure);
+
+// Zeroed particle storage on huge pages. The job workers zero it one whole huge page each, so the
+// page faults are spread over the pool. Stages hand out ranges by work stealing, not to fixed
+// workers, so this places no part of the array on any particular NUMA node.
+Circle* allocateCircles(int numCircles);
+void freeCircles(Circle* circles, int numCircles);
 
-void updatePosition(Circle* circles, int numCircles, float timestep);//(float* xPos, float* yPos, float* xVelocity, float* yVelocity,float time);
\ No newline at end of file
+#endif // PHYSICS_H
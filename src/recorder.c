@@ -0,0 +1,245 @@
+#define _GNU_SOURCE // O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "recorder.h"
+
+#define RECORDER_BATCH_BYTES ((size_t)4 << 20) // multiple of RECORDER_BLOCK_SIZE
+#define RECORDER_BLOCK_SIZE 4096               // O_DIRECT transfer alignment
+#define PACK_PARTICLES 1024
+
+static int writeAll(int fd, const unsigned char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+// Write out the batch, with O_DIRECT only whole blocks unless this is the final flush
+static void flushBatch(Recorder* recorder, bool final) {
+    size_t length = recorder->batchUsed;
+    if (recorder->direct && !final) {
+        length &= ~(size_t)(RECORDER_BLOCK_SIZE - 1);
+    }
+#ifdef O_DIRECT
+    if (recorder->direct && final && length % RECORDER_BLOCK_SIZE != 0) {
+        // The unaligned tail goes through the page cache
+        fcntl(recorder->fd, F_SETFL, fcntl(recorder->fd, F_GETFL) & ~O_DIRECT);
+        recorder->direct = false;
+    }
+#endif
+    if (length == 0 || recorder->failed) return;
+
+    if (writeAll(recorder->fd, recorder->batch, length) != 0) {
+        perror("trajectory write");
+        recorder->failed = 1;
+        return;
+    }
+    memmove(recorder->batch, recorder->batch + length, recorder->batchUsed - length);
+    recorder->batchUsed -= length;
+}
+
+static void appendBytes(Recorder* recorder, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    while (size > 0) {
+        size_t space = RECORDER_BATCH_BYTES - recorder->batchUsed;
+        size_t count = size < space ? size : space;
+        memcpy(recorder->batch + recorder->batchUsed, bytes, count);
+        recorder->batchUsed += count;
+        bytes += count;
+        size -= count;
+        if (recorder->batchUsed == RECORDER_BATCH_BYTES) flushBatch(recorder, false);
+    }
+}
+
+static void packFrame(Recorder* recorder, const Circle* circles, int activeCount, long long step) {
+    TrajectoryFrameHeader header;
+    memset(&header, 0, sizeof(header));
+    header.step = step;
+    header.activeCount = activeCount;
+    if (recorder->encoding == TRAJECTORY_QUANTISED) {
+        header.payloadBytes = (uint32_t)TrajectoryCodec_Encode(&recorder->codec, circles, &header.flags);
+        appendBytes(recorder, &header, sizeof(header));
+        appendBytes(recorder, recorder->codec.payload, header.payloadBytes);
+        return;
+    }
+
+    // The quantised coder needs a fixed particle count, raw frames leave out the inactive tail
+    header.flags = TRAJECTORY_KEYFRAME;
+    header.payloadBytes = (uint32_t)(sizeof(float) * 2 * (size_t)activeCount);
+    appendBytes(recorder, &header, sizeof(header));
+
+    float positions[2 * PACK_PARTICLES];
+    for (int begin = 0; begin < activeCount; begin += PACK_PARTICLES) {
+        int count = activeCount - begin < PACK_PARTICLES ? activeCount - begin : PACK_PARTICLES;
+        for (int i = 0; i < count; i++) {
+            positions[2 * i] = circles[begin + i].xPos;
+            positions[2 * i + 1] = circles[begin + i].yPos;
+        }
+        appendBytes(recorder, positions, sizeof(float) * 2 * (size_t)count);
+    }
+}
+
+static void* writerThread(void* arg) {
+    Recorder* recorder = arg;
+    pthread_mutex_lock(&recorder->lock);
+    for (;;) {
+        while (recorder->queued == 0 && recorder->running) {
+            pthread_cond_wait(&recorder->frameQueued, &recorder->lock);
+        }
+        if (recorder->queued == 0) break; // stopped and drained
+
+        // The tail slot stays ours until it is released below
+        int slot = recorder->tail;
+        pthread_mutex_unlock(&recorder->lock);
+        packFrame(recorder, &recorder->frames[(size_t)slot * recorder->numParticles], recorder->frameCounts[slot],
+                  recorder->frameSteps[slot]);
+        pthread_mutex_lock(&recorder->lock);
+
+        recorder->tail = (slot + 1) % recorder->numFrames;
+        recorder->queued--;
+        pthread_cond_signal(&recorder->frameWritten);
+        if (recorder->queued == 0) {
+            // Caught up, write what has been batched so far
+            pthread_mutex_unlock(&recorder->lock);
+            flushBatch(recorder, false);
+            pthread_mutex_lock(&recorder->lock);
+        }
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    flushBatch(recorder, true);
+    return NULL;
+}
+
+int Recorder_Open(Recorder* recorder, const char* path, const Circle* circles, int numParticles, int numFrames,
+                  int every, RecorderPolicy policy, bool direct, TrajectoryEncoding encoding) {
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->numParticles = numParticles;
+    recorder->numFrames = numFrames > 0 ? numFrames : 1;
+    recorder->every = every > 0 ? every : 1;
+    recorder->policy = policy;
+    recorder->encoding = encoding;
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    recorder->fd = -1;
+#ifdef O_DIRECT
+    if (direct) {
+        recorder->fd = open(path, flags | O_DIRECT, 0644);
+        recorder->direct = recorder->fd >= 0;
+        if (!recorder->direct) {
+            fprintf(stderr, "O_DIRECT not supported for %s, using buffered writes\n", path);
+        }
+    }
+#else
+    (void)direct;
+#endif
+    if (recorder->fd < 0) recorder->fd = open(path, flags, 0644);
+    if (recorder->fd < 0) {
+        fprintf(stderr, "Could not open trajectory file %s\n", path);
+        return -1;
+    }
+
+    recorder->frames = malloc(sizeof(Circle) * (size_t)numParticles * recorder->numFrames);
+    recorder->frameSteps = malloc(sizeof(long long) * recorder->numFrames);
+    recorder->frameCounts = malloc(sizeof(int) * recorder->numFrames);
+    recorder->batch = aligned_alloc(RECORDER_BLOCK_SIZE, RECORDER_BATCH_BYTES);
+    int codecFailed = encoding == TRAJECTORY_QUANTISED &&
+                      TrajectoryCodec_Init(&recorder->codec, numParticles, RECORDER_KEYFRAME_INTERVAL) != 0;
+    if (!recorder->frames || !recorder->frameSteps || !recorder->frameCounts || !recorder->batch || codecFailed) {
+        fprintf(stderr, "Failed to allocate memory for trajectory recorder\n");
+        free(recorder->frames);
+        free(recorder->frameSteps);
+        free(recorder->frameCounts);
+        free(recorder->batch);
+        close(recorder->fd);
+        return -1;
+    }
+
+    TrajectoryHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRAJECTORY_MAGIC, 4);
+    header.version = TRAJECTORY_VERSION;
+    header.numParticles = numParticles;
+    header.every = recorder->every;
+    header.encoding = encoding;
+    appendBytes(recorder, &header, sizeof(header));
+    for (int i = 0; i < numParticles; i++) {
+        appendBytes(recorder, &circles[i].radius, sizeof(float));
+    }
+
+    pthread_mutex_init(&recorder->lock, NULL);
+    pthread_cond_init(&recorder->frameQueued, NULL);
+    pthread_cond_init(&recorder->frameWritten, NULL);
+    recorder->running = true;
+    if (pthread_create(&recorder->writer, NULL, writerThread, recorder) != 0) {
+        fprintf(stderr, "Failed to start trajectory writer\n");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
+
+bool Recorder_Record(Recorder* recorder, const Circle* circles, int activeCount, long long step) {
+    if (step % recorder->every != 0) return true;
+
+    pthread_mutex_lock(&recorder->lock);
+    if (recorder->queued == recorder->numFrames) {
+        if (recorder->policy == RECORDER_DROP) {
+            recorder->dropped++;
+            pthread_mutex_unlock(&recorder->lock);
+            return false;
+        }
+        while (recorder->queued == recorder->numFrames) {
+            pthread_cond_wait(&recorder->frameWritten, &recorder->lock);
+        }
+    }
+    int slot = recorder->head;
+    pthread_mutex_unlock(&recorder->lock);
+
+    // The head slot is invisible to the writer until it is queued
+    memcpy(&recorder->frames[(size_t)slot * recorder->numParticles], circles,
+           sizeof(Circle) * (size_t)recorder->numParticles);
+    recorder->frameSteps[slot] = step;
+    recorder->frameCounts[slot] = activeCount < recorder->numParticles ? activeCount : recorder->numParticles;
+
+    pthread_mutex_lock(&recorder->lock);
+    recorder->head = (slot + 1) % recorder->numFrames;
+    recorder->queued++;
+    recorder->recorded++;
+    pthread_cond_signal(&recorder->frameQueued);
+    pthread_mutex_unlock(&recorder->lock);
+    return true;
+}
+
+void Recorder_Close(Recorder* recorder) {
+    if (recorder->fd < 0) return;
+    pthread_mutex_lock(&recorder->lock);
+    recorder->running = false;
+    pthread_cond_signal(&recorder->frameQueued);
+    pthread_mutex_unlock(&recorder->lock);
+    pthread_join(recorder->writer, NULL);
+
+    fsync(recorder->fd);
+    close(recorder->fd);
+    printf("Trajectory: %lld frames recorded, %lld dropped\n", recorder->recorded, recorder->dropped);
+
+    pthread_mutex_destroy(&recorder->lock);
+    pthread_cond_destroy(&recorder->frameQueued);
+    pthread_cond_destroy(&recorder->frameWritten);
+    free(recorder->frames);
+    free(recorder->frameSteps);
+    free(recorder->frameCounts);
+    free(recorder->batch);
+    if (recorder->encoding == TRAJECTORY_QUANTISED) {
+        TrajectoryCodec_Destroy(&recorder->codec);
+    }
+    recorder->fd = -1;
+}
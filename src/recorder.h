@@ -0,0 +1,59 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "circle.h"
+#include "trajectory.h"
+
+#define RECORDER_KEYFRAME_INTERVAL 64 // quantised frames between keyframes
+
+typedef enum {
+    RECORDER_DROP,          // skip frames while the ring is full, the simulation never waits
+    RECORDER_BLOCK          // wait for the writer, no frame is ever lost
+} RecorderPolicy;
+
+// Streams every Nth simulation step to a trajectory file (see trajectory.h). Recording copies the
+// particle array into a free slot of a pre-allocated ring; a writer thread packs the queued frames
+// into large batches and writes them out, optionally bypassing the page cache with O_DIRECT.
+typedef struct {
+    int fd;
+    int numParticles;
+    int every;
+    RecorderPolicy policy;
+    bool direct;
+    TrajectoryEncoding encoding;
+    TrajectoryCodec codec;  // used by the writer thread for TRAJECTORY_QUANTISED
+
+    Circle* frames;         // ring of numFrames particle arrays
+    long long* frameSteps;
+    int* frameCounts;       // active particles of every frame
+    int numFrames;
+    int head, tail, queued; // head is the next slot to fill, tail the next to write
+
+    unsigned char* batch;   // writer thread staging buffer
+    size_t batchUsed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t frameQueued;
+    pthread_cond_t frameWritten;
+    pthread_t writer;
+    bool running;
+    long long recorded, dropped;
+    int failed;
+} Recorder;
+
+// The header stores the radii of the numParticles circles, which stay fixed while recording
+int Recorder_Open(Recorder* recorder, const char* path, const Circle* circles, int numParticles, int numFrames,
+                  int every, RecorderPolicy policy, bool direct, TrajectoryEncoding encoding);
+
+// Called by the simulation thread after each step, records steps that are a multiple of every.
+// activeCount is the number of particles in the simulation, raw frames store only those.
+// Returns false when the frame was dropped.
+bool Recorder_Record(Recorder* recorder, const Circle* circles, int activeCount, long long step);
+
+// Writes out every queued frame, then stops the writer and closes the file
+void Recorder_Close(Recorder* recorder);
+
+#endif // RECORDER_H
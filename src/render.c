@@ -0,0 +1,719 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "render.h"
+
+// The view uniform holds the camera centre and zoom. Quads are padded by a pixel so the
+// anti-aliased rim of small discs isn't clipped, vLocal is the fragment position in radii.
+static const char* impostorVertexSource = "#version 450 core\n"
+    "layout(location = 0) in vec2 aCorner;\n"
+    "layout(location = 1) in vec2 aCenter;\n"
+    "layout(location = 2) in float aRadius;\n"
+    "uniform vec3 view;\n"
+    "uniform float pixelSize;\n"
+    "out vec2 vLocal;\n"
+    "void main() {\n"
+    "    float radius = aRadius * view.z;\n"
+    "    float extent = radius + pixelSize;\n"
+    "    vLocal = aCorner * (extent / radius);\n"
+    "    gl_Position = vec4((aCenter - view.xy) * view.z + aCorner * extent, 0.0, 1.0);\n"
+    "}\0";
+
+// Coverage falls from 1 to 0 across one pixel around the edge, fwidth gives the pixel size in radii
+static const char* impostorFragmentSource = "#version 450 core\n"
+    "in vec2 vLocal;\n"
+    "out vec4 FragColor;\n"
+    "void main() {\n"
+    "    float distance = length(vLocal);\n"
+    "    float edge = fwidth(distance);\n"
+    "    float coverage = clamp((1.0 - distance) / edge + 0.5, 0.0, 1.0);\n"
+    "    if (coverage <= 0.0) discard;\n"
+    "    FragColor = vec4(1.0, 1.0, 1.0, coverage);\n"
+    "}\0";
+
+static const char* meshVertexSource = "#version 450 core\n"
+    "layout(location = 0) in vec2 aRim;\n"
+    "layout(location = 1) in vec2 aCenter;\n"
+    "layout(location = 2) in float aRadius;\n"
+    "uniform vec3 view;\n"
+    "void main() {\n"
+    "    gl_Position = vec4((aCenter + aRim * aRadius - view.xy) * view.z, 0.0, 1.0);\n"
+    "}\0";
+
+static const char* meshFragmentSource = "#version 450 core\n"
+    "out vec4 FragColor;\n"
+    "void main() {\n"
+    "    FragColor = vec4(1.0, 1.0, 1.0, 1.0);\n"
+    "}\0";
+
+// Splat kernel (1 - q^2)^2 over a support of the particle's diameter, or 1.5 texels for particles
+// smaller than that. Its weight is the particle's area times the kernel normalised to integrate to
+// one, 3 / (pi h^2), so the weights summed in a texel are the fraction of its area particles cover.
+static const char* splatVertexSource = "#version 450 core\n"
+    "layout(location = 0) in vec2 aCorner;\n"
+    "layout(location = 1) in vec2 aCenter;\n"
+    "layout(location = 2) in float aRadius;\n"
+    "layout(location = 3) in float aValue;\n"
+    "uniform vec3 view;\n"
+    "uniform float texelSize;\n"
+    "out vec2 vLocal;\n"
+    "out float vWeight;\n"
+    "out float vValue;\n"
+    "void main() {\n"
+    "    float radius = aRadius * view.z;\n"
+    "    float support = max(2.0 * radius, 1.5 * texelSize);\n"
+    "    vLocal = aCorner;\n"
+    "    vWeight = 3.0 * radius * radius / (support * support);\n"
+    "    vValue = aValue;\n"
+    "    gl_Position = vec4((aCenter - view.xy) * view.z + aCorner * support, 0.0, 1.0);\n"
+    "}\0";
+
+static const char* splatFragmentSource = "#version 450 core\n"
+    "in vec2 vLocal;\n"
+    "in float vWeight;\n"
+    "in float vValue;\n"
+    "out vec2 Accumulated;\n"
+    "void main() {\n"
+    "    float falloff = 1.0 - dot(vLocal, vLocal);\n"
+    "    if (falloff <= 0.0) discard;\n"
+    "    float weight = vWeight * falloff * falloff;\n"
+    "    Accumulated = vec2(weight, weight * vValue);\n"
+    "}\0";
+
+static const char* fieldVertexSource = "#version 450 core\n"
+    "out vec2 vUV;\n"
+    "void main() {\n"
+    "    vec2 corner = vec2(float((gl_VertexID & 1) << 2) - 1.0, float((gl_VertexID & 2) << 1) - 1.0);\n"
+    "    vUV = 0.5 * corner + 0.5;\n"
+    "    gl_Position = vec4(corner, 0.0, 1.0);\n"
+    "}\0";
+
+// Density (mode 1) shows the covered fraction itself, the other modes the weighted mean of the values.
+// Both run through a viridis-like ramp over range and fade out where little area is covered.
+static const char* fieldFragmentSource = "#version 450 core\n"
+    "in vec2 vUV;\n"
+    "uniform sampler2D field;\n"
+    "uniform int mode;\n"
+    "uniform vec2 range;\n"
+    "out vec4 FragColor;\n"
+    "const vec3 ramp[5] = vec3[](vec3(0.267, 0.005, 0.329), vec3(0.229, 0.322, 0.546),\n"
+    "                            vec3(0.128, 0.567, 0.551), vec3(0.369, 0.789, 0.383),\n"
+    "                            vec3(0.993, 0.906, 0.144));\n"
+    "void main() {\n"
+    "    vec2 sums = texture(field, vUV).rg;\n"
+    "    float value = mode == 1 ? sums.r : sums.g / max(sums.r, 1e-6);\n"
+    "    float t = 4.0 * clamp((value - range.x) / max(range.y - range.x, 1e-6), 0.0, 1.0);\n"
+    "    int stop = min(int(t), 3);\n"
+    "    FragColor = vec4(mix(ramp[stop], ramp[stop + 1], t - float(stop)), clamp(10.0 * sums.r, 0.0, 1.0));\n"
+    "}\0";
+
+#define RENDER_MAX_RANGES SNAPSHOT_GRID
+#define CAMERA_MIN_ZOOM 0.01f
+#define CAMERA_MAX_ZOOM 100000.0f
+
+// Segments of each level, the last one is the full-quality circle of the original renderer
+static const int meshLevelSegments[MESH_LOD_LEVELS] = { 6, 12, 24, 48, MESH_MAX_SEGMENTS };
+
+static GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint success;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+        fprintf(stderr, "Shader compilation failed:\n%s\n", infoLog);
+        exit(EXIT_FAILURE);
+    }
+    return shader;
+}
+
+GLuint Render_CreateProgram(const char* vertexSource, const char* fragmentSource) {
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    glLinkProgram(program);
+
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        char infoLog[512];
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        fprintf(stderr, "Shader linking failed:\n%s\n", infoLog);
+        exit(EXIT_FAILURE);
+    }
+
+    // shaders no longer needed after linking
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return program;
+}
+
+void Camera2D_Reset(Camera2D* camera) {
+    camera->centerX = 0.0f;
+    camera->centerY = 0.0f;
+    camera->zoom = 1.0f;
+}
+
+void Camera2D_Pan(Camera2D* camera, float dx, float dy) {
+    camera->centerX -= dx / camera->zoom;
+    camera->centerY -= dy / camera->zoom;
+}
+
+void Camera2D_ZoomAt(Camera2D* camera, float factor, float x, float y) {
+    float worldX = camera->centerX + x / camera->zoom;
+    float worldY = camera->centerY + y / camera->zoom;
+    camera->zoom = fminf(fmaxf(camera->zoom * factor, CAMERA_MIN_ZOOM), CAMERA_MAX_ZOOM);
+    camera->centerX = worldX - x / camera->zoom;
+    camera->centerY = worldY - y / camera->zoom;
+}
+
+void Camera2D_Bounds(const Camera2D* camera, float* minX, float* minY, float* maxX, float* maxY) {
+    float halfExtent = 1.0f / camera->zoom;
+    *minX = camera->centerX - halfExtent;
+    *maxX = camera->centerX + halfExtent;
+    *minY = camera->centerY - halfExtent;
+    *maxY = camera->centerY + halfExtent;
+}
+
+// Runs of the state's particles that may touch the view: cells whose centres lie within margin
+// of the visible rectangle
+static int visibleRanges(const SnapshotSlot* state, const Camera2D* camera, float margin, int* first, int* count) {
+    float minX, minY, maxX, maxY;
+    Camera2D_Bounds(camera, &minX, &minY, &maxX, &maxY);
+    return Snapshot_Ranges(state, minX - margin, minY - margin, maxX + margin, maxY + margin,
+                           first, count, RENDER_MAX_RANGES);
+}
+
+void ImpostorRenderer_Init(ImpostorRenderer* renderer, int capacity) {
+    static const float corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+    renderer->program = Render_CreateProgram(impostorVertexSource, impostorFragmentSource);
+    renderer->pixelSizeLocation = glGetUniformLocation(renderer->program, "pixelSize");
+    renderer->viewLocation = glGetUniformLocation(renderer->program, "view");
+    renderer->capacity = capacity;
+
+    glGenVertexArrays(1, &renderer->VAO);
+    glGenBuffers(1, &renderer->cornerBuffer);
+    glGenBuffers(1, &renderer->positionBuffer);
+    glGenBuffers(1, &renderer->radiusBuffer);
+    glBindVertexArray(renderer->VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->cornerBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->positionBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * (size_t)capacity, NULL, GL_STREAM_DRAW);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->radiusBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * (size_t)capacity, NULL, GL_STREAM_DRAW);
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(2);
+
+    glBindVertexArray(0);
+}
+
+// Source the centres and radii from the given buffers and offsets, and set up the program
+static void bindInstances(ImpostorRenderer* renderer, const Camera2D* camera, GLuint positions,
+                          size_t positionOffset, GLuint radii, size_t radiusOffset,
+                          int viewportWidth, int viewportHeight) {
+    glBindVertexArray(renderer->VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, positions);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)positionOffset);
+    glBindBuffer(GL_ARRAY_BUFFER, radii);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)radiusOffset);
+
+    // Clip space spans 2 units across the viewport, pad by the larger of the two pixel sizes
+    int pixels = viewportWidth < viewportHeight ? viewportWidth : viewportHeight;
+    glUseProgram(renderer->program);
+    glUniform1f(renderer->pixelSizeLocation, 2.0f / (float)(pixels > 0 ? pixels : 1));
+    glUniform3f(renderer->viewLocation, camera->centerX, camera->centerY, camera->zoom);
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+static void unbindInstances(void) {
+    glDisable(GL_BLEND);
+    glBindVertexArray(0);
+}
+
+void ImpostorRenderer_Draw(ImpostorRenderer* renderer, const SnapshotSlot* state, const Camera2D* camera,
+                           int viewportWidth, int viewportHeight) {
+    int first[RENDER_MAX_RANGES], count[RENDER_MAX_RANGES];
+    int numRanges = visibleRanges(state, camera, state->maxRadius, first, count);
+
+    // Pack the visible runs back to back at the start of the instance buffers
+    int packed = 0;
+    for (int r = 0; r < numRanges; r++) {
+        int n = count[r] < renderer->capacity - packed ? count[r] : renderer->capacity - packed;
+        glBindBuffer(GL_ARRAY_BUFFER, renderer->positionBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * 2 * (size_t)packed, sizeof(float) * 2 * (size_t)n,
+                        state->positions + 2 * (size_t)first[r]);
+        glBindBuffer(GL_ARRAY_BUFFER, renderer->radiusBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * (size_t)packed, sizeof(float) * (size_t)n,
+                        state->radii + first[r]);
+        packed += n;
+    }
+    if (packed == 0) return;
+
+    bindInstances(renderer, camera, renderer->positionBuffer, 0, renderer->radiusBuffer, 0,
+                  viewportWidth, viewportHeight);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, packed);
+    unbindInstances();
+}
+
+void ImpostorRenderer_DrawStream(ImpostorRenderer* renderer, const StreamBuffer* stream, const SnapshotSlot* state,
+                                 const Camera2D* camera, int viewportWidth, int viewportHeight) {
+    int first[RENDER_MAX_RANGES], count[RENDER_MAX_RANGES];
+    int numRanges = visibleRanges(state, camera, state->maxRadius, first, count);
+    if (numRanges == 0) return;
+
+    // The state's arrays are in the region already, each visible run is drawn where it lies
+    const char* region = StreamBuffer_Region(stream, state->index);
+    size_t offset = StreamBuffer_Offset(stream, state->index);
+    bindInstances(renderer, camera, stream->buffer, offset + (size_t)((const char*)state->positions - region),
+                  stream->buffer, offset + (size_t)((const char*)state->radii - region),
+                  viewportWidth, viewportHeight);
+    for (int r = 0; r < numRanges; r++) {
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, count[r], (GLuint)first[r]);
+    }
+    unbindInstances();
+}
+
+void ImpostorRenderer_Destroy(ImpostorRenderer* renderer) {
+    glDeleteVertexArrays(1, &renderer->VAO);
+    glDeleteBuffers(1, &renderer->cornerBuffer);
+    glDeleteBuffers(1, &renderer->positionBuffer);
+    glDeleteBuffers(1, &renderer->radiusBuffer);
+    glDeleteProgram(renderer->program);
+}
+
+int StreamBuffer_Init(StreamBuffer* stream, size_t regionSize, int numRegions) {
+    memset(stream, 0, sizeof(*stream));
+    if (numRegions < 1 || numRegions > STREAM_MAX_REGIONS) {
+        fprintf(stderr, "Stream buffer needs 1 to %d regions, got %d\n", STREAM_MAX_REGIONS, numRegions);
+        return -1;
+    }
+    // Regions start on cache lines so a writer never shares one with a region the GPU reads
+    stream->regionSize = (regionSize + 63) & ~(size_t)63;
+    stream->numRegions = numRegions;
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr size = (GLsizeiptr)(stream->regionSize * numRegions);
+    glGenBuffers(1, &stream->buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+    glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+    stream->mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+    if (!stream->mapped) {
+        fprintf(stderr, "Failed to map %ld byte stream buffer\n", (long)size);
+        StreamBuffer_Destroy(stream);
+        return -1;
+    }
+    return 0;
+}
+
+void* StreamBuffer_Region(const StreamBuffer* stream, int region) {
+    return stream->mapped + StreamBuffer_Offset(stream, region);
+}
+
+size_t StreamBuffer_Offset(const StreamBuffer* stream, int region) {
+    return stream->regionSize * (size_t)region;
+}
+
+void StreamBuffer_Fence(StreamBuffer* stream, int region) {
+    if (stream->fences[region]) {
+        glDeleteSync(stream->fences[region]);
+    }
+    stream->fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void StreamBuffer_Wait(StreamBuffer* stream, int region) {
+    GLsync fence = stream->fences[region];
+    if (!fence) {
+        return;
+    }
+    // The first wait flushes the fence to the GPU, later ones only poll
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;) {
+        GLenum result = glClientWaitSync(fence, flags, 1000000000);
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+            break;
+        }
+        if (result == GL_WAIT_FAILED) {
+            fprintf(stderr, "Waiting on stream buffer region %d failed\n", region);
+            break;
+        }
+        flags = 0;
+    }
+    glDeleteSync(fence);
+    stream->fences[region] = NULL;
+}
+
+void StreamBuffer_Destroy(StreamBuffer* stream) {
+    for (int r = 0; r < stream->numRegions; r++) {
+        if (stream->fences[r]) {
+            glDeleteSync(stream->fences[r]);
+            stream->fences[r] = NULL;
+        }
+    }
+    if (stream->mapped) {
+        glBindBuffer(GL_ARRAY_BUFFER, stream->buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        stream->mapped = NULL;
+    }
+    glDeleteBuffers(1, &stream->buffer);
+    stream->buffer = 0;
+}
+
+// A fan of n segments misses the circle by r (1 - cos(pi / n)) ~ r pi^2 / (2 n^2), which stays
+// under a quarter pixel for n >= pi sqrt(2 r)
+static int meshLevel(float radiusPixels) {
+    float needed = 3.14159265f * sqrtf(2.0f * radiusPixels);
+    for (int level = 0; level < MESH_LOD_LEVELS - 1; level++) {
+        if (meshLevelSegments[level] >= needed) {
+            return level;
+        }
+    }
+    return MESH_LOD_LEVELS - 1;
+}
+
+int MeshRenderer_Init(MeshRenderer* renderer, int capacity) {
+    memset(renderer, 0, sizeof(*renderer));
+    renderer->instances = malloc(sizeof(float) * 3 * (size_t)capacity);
+    renderer->levels = malloc((size_t)capacity);
+
+    // Centre plus segments + 1 rim vertices per fan, the last closing the circle
+    int numVertices = 0;
+    for (int level = 0; level < MESH_LOD_LEVELS; level++) {
+        numVertices += meshLevelSegments[level] + 2;
+    }
+    float* fans = malloc(sizeof(float) * 2 * numVertices);
+    if (!renderer->instances || !renderer->levels || !fans) {
+        fprintf(stderr, "Failed to allocate memory for circle meshes\n");
+        free(fans);
+        free(renderer->instances);
+        free(renderer->levels);
+        return -1;
+    }
+    float* vertex = fans;
+    int first = 0;
+    for (int level = 0; level < MESH_LOD_LEVELS; level++) {
+        int segments = meshLevelSegments[level];
+        renderer->segments[level] = segments;
+        renderer->firstVertex[level] = first;
+        *vertex++ = 0.0f;
+        *vertex++ = 0.0f;
+        for (int i = 0; i <= segments; i++) {
+            float theta = 2.0f * 3.14159265f * (i % segments) / segments;
+            *vertex++ = cosf(theta);
+            *vertex++ = sinf(theta);
+        }
+        first += segments + 2;
+    }
+
+    renderer->program = Render_CreateProgram(meshVertexSource, meshFragmentSource);
+    renderer->viewLocation = glGetUniformLocation(renderer->program, "view");
+    renderer->capacity = capacity;
+
+    glGenVertexArrays(1, &renderer->VAO);
+    glGenBuffers(1, &renderer->fanBuffer);
+    glGenBuffers(1, &renderer->instanceBuffer);
+    glBindVertexArray(renderer->VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->fanBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * numVertices, fans, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * (size_t)capacity, NULL, GL_STREAM_DRAW);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(2 * sizeof(float)));
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(2);
+
+    glBindVertexArray(0);
+    free(fans);
+    return 0;
+}
+
+void MeshRenderer_Draw(MeshRenderer* renderer, const SnapshotSlot* state, const Camera2D* camera,
+                       float pixelsPerUnit) {
+    int first[RENDER_MAX_RANGES], count[RENDER_MAX_RANGES];
+    int numRanges = visibleRanges(state, camera, state->maxRadius, first, count);
+
+    // Counting sort of the visible particles by level into the staging instances
+    unsigned char* levels = renderer->levels;
+    int offsets[MESH_LOD_LEVELS] = { 0 };
+    memset(renderer->levelCounts, 0, sizeof(renderer->levelCounts));
+    float radiusPixels = pixelsPerUnit * camera->zoom;
+    int numVisible = 0;
+    for (int r = 0; r < numRanges; r++) {
+        for (int i = first[r]; i < first[r] + count[r] && numVisible < renderer->capacity; i++) {
+            int level = meshLevel(state->radii[i] * radiusPixels);
+            renderer->levelCounts[level]++;
+            levels[numVisible++] = (unsigned char)level;
+        }
+    }
+    if (numVisible == 0) return;
+    for (int level = 1; level < MESH_LOD_LEVELS; level++) {
+        offsets[level] = offsets[level - 1] + renderer->levelCounts[level - 1];
+    }
+    int v = 0;
+    for (int r = 0; r < numRanges; r++) {
+        for (int i = first[r]; i < first[r] + count[r] && v < numVisible; i++) {
+            float* instance = &renderer->instances[3 * offsets[levels[v++]]++];
+            instance[0] = state->positions[2 * i];
+            instance[1] = state->positions[2 * i + 1];
+            instance[2] = state->radii[i];
+        }
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->instanceBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * 3 * (size_t)numVisible, renderer->instances);
+
+    glUseProgram(renderer->program);
+    glUniform3f(renderer->viewLocation, camera->centerX, camera->centerY, camera->zoom);
+    glBindVertexArray(renderer->VAO);
+    int base = 0;
+    for (int level = 0; level < MESH_LOD_LEVELS; level++) {
+        if (renderer->levelCounts[level] > 0) {
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLE_FAN, renderer->firstVertex[level],
+                                              renderer->segments[level] + 2, renderer->levelCounts[level],
+                                              (GLuint)base);
+        }
+        base += renderer->levelCounts[level];
+    }
+    glBindVertexArray(0);
+}
+
+void MeshRenderer_Destroy(MeshRenderer* renderer) {
+    glDeleteVertexArrays(1, &renderer->VAO);
+    glDeleteBuffers(1, &renderer->fanBuffer);
+    glDeleteBuffers(1, &renderer->instanceBuffer);
+    glDeleteProgram(renderer->program);
+    free(renderer->instances);
+    free(renderer->levels);
+}
+
+int HeatmapRenderer_Init(HeatmapRenderer* renderer, int capacity, int resolution) {
+    static const float corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+    memset(renderer, 0, sizeof(*renderer));
+    renderer->splatProgram = Render_CreateProgram(splatVertexSource, splatFragmentSource);
+    renderer->splatViewLocation = glGetUniformLocation(renderer->splatProgram, "view");
+    renderer->texelSizeLocation = glGetUniformLocation(renderer->splatProgram, "texelSize");
+    renderer->colorProgram = Render_CreateProgram(fieldVertexSource, fieldFragmentSource);
+    renderer->modeLocation = glGetUniformLocation(renderer->colorProgram, "mode");
+    renderer->rangeLocation = glGetUniformLocation(renderer->colorProgram, "range");
+    renderer->resolution = resolution;
+    renderer->capacity = capacity;
+
+    glGenVertexArrays(1, &renderer->splatVAO);
+    glGenVertexArrays(1, &renderer->fieldVAO);
+    glGenBuffers(1, &renderer->cornerBuffer);
+    glGenBuffers(1, &renderer->positionBuffer);
+    glGenBuffers(1, &renderer->radiusBuffer);
+    glGenBuffers(1, &renderer->valueBuffer);
+    glBindVertexArray(renderer->splatVAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->cornerBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->positionBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * (size_t)capacity, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->radiusBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * (size_t)capacity, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, renderer->valueBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * (size_t)capacity, NULL, GL_STREAM_DRAW);
+    for (GLuint attribute = 1; attribute <= 3; attribute++) {
+        glVertexAttribDivisor(attribute, 1);
+        glEnableVertexAttribArray(attribute);
+    }
+    glBindVertexArray(0);
+
+    // Float accumulation target, filtered linearly when the colour pass stretches it over the viewport
+    glGenTextures(1, &renderer->fieldTexture);
+    glBindTexture(GL_TEXTURE_2D, renderer->fieldTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, resolution, resolution, 0, GL_RG, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    GLint previous;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+    glGenFramebuffers(1, &renderer->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, renderer->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, renderer->fieldTexture, 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)previous);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Heatmap framebuffer incomplete: 0x%x\n", status);
+        HeatmapRenderer_Destroy(renderer);
+        return -1;
+    }
+    return 0;
+}
+
+// Peak covered fraction at the resolution of the state's grid, the top of the density colour map.
+// Unsorted states have no grid and are mapped up to full coverage.
+static float peakCoverage(const SnapshotSlot* state) {
+    if (!state->cellStart || state->count == 0) {
+        return 1.0f;
+    }
+    int busiest = 0;
+    for (int c = 0; c < SNAPSHOT_GRID * SNAPSHOT_GRID; c++) {
+        int n = state->cellStart[c + 1] - state->cellStart[c];
+        busiest = n > busiest ? n : busiest;
+    }
+    float area = 3.14159265f * state->maxRadius * state->maxRadius;
+    float peak = busiest * area / (state->cellSize * state->cellSize);
+    return peak > 0.0f ? peak : 1.0f;
+}
+
+// Particles whose kernel may reach into the view: the support is the larger of the diameter and
+// 1.5 texels
+static float splatMargin(const HeatmapRenderer* renderer, const SnapshotSlot* state, const Camera2D* camera) {
+    float texel = 3.0f / (renderer->resolution * camera->zoom);
+    return fmaxf(2.0f * state->maxRadius, texel);
+}
+
+// Point the instance attributes at the given buffers and offsets, a value buffer of 0 splats zeros,
+// then clear the field and set up additive splatting into it. Returns the framebuffer to go back to.
+static GLuint beginSplat(HeatmapRenderer* renderer, const Camera2D* camera, GLuint positions, size_t positionOffset,
+                         GLuint radii, size_t radiusOffset, GLuint values, size_t valueOffset) {
+    glBindVertexArray(renderer->splatVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, positions);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)positionOffset);
+    glBindBuffer(GL_ARRAY_BUFFER, radii);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)radiusOffset);
+    if (values) {
+        glBindBuffer(GL_ARRAY_BUFFER, values);
+        glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void*)valueOffset);
+        glEnableVertexAttribArray(3);
+    } else {
+        glDisableVertexAttribArray(3);
+        glVertexAttrib1f(3, 0.0f);
+    }
+
+    GLint previous;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+    static const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glBindFramebuffer(GL_FRAMEBUFFER, renderer->framebuffer);
+    glViewport(0, 0, renderer->resolution, renderer->resolution);
+    glClearBufferfv(GL_COLOR, 0, zero);
+
+    glUseProgram(renderer->splatProgram);
+    glUniform3f(renderer->splatViewLocation, camera->centerX, camera->centerY, camera->zoom);
+    glUniform1f(renderer->texelSizeLocation, 2.0f / renderer->resolution);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    return (GLuint)previous;
+}
+
+// Colour-map the accumulated field over the viewport of the framebuffer that was bound before
+static void resolveField(HeatmapRenderer* renderer, const SnapshotSlot* state, HeatmapMode mode, GLuint framebuffer,
+                         int viewportWidth, int viewportHeight) {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, viewportWidth, viewportHeight);
+
+    float top = mode == HEATMAP_DENSITY ? peakCoverage(state) : state->maxValue > 0.0f ? state->maxValue : 1.0f;
+    glUseProgram(renderer->colorProgram);
+    glUniform1i(renderer->modeLocation, (GLint)mode);
+    glUniform2f(renderer->rangeLocation, 0.0f, top);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, renderer->fieldTexture);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBindVertexArray(renderer->fieldVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_BLEND);
+    glBindVertexArray(0);
+}
+
+void HeatmapRenderer_Draw(HeatmapRenderer* renderer, const SnapshotSlot* state, const Camera2D* camera,
+                          HeatmapMode mode, int viewportWidth, int viewportHeight) {
+    if (!state->hasValues) {
+        mode = HEATMAP_DENSITY;
+    }
+    bool withValues = mode != HEATMAP_DENSITY;
+    int first[RENDER_MAX_RANGES], count[RENDER_MAX_RANGES];
+    int numRanges = visibleRanges(state, camera, splatMargin(renderer, state, camera), first, count);
+
+    // Pack the visible runs back to back at the start of the instance buffers
+    int packed = 0;
+    for (int r = 0; r < numRanges; r++) {
+        int n = count[r] < renderer->capacity - packed ? count[r] : renderer->capacity - packed;
+        glBindBuffer(GL_ARRAY_BUFFER, renderer->positionBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * 2 * (size_t)packed, sizeof(float) * 2 * (size_t)n,
+                        state->positions + 2 * (size_t)first[r]);
+        glBindBuffer(GL_ARRAY_BUFFER, renderer->radiusBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * (size_t)packed, sizeof(float) * (size_t)n,
+                        state->radii + first[r]);
+        if (withValues) {
+            glBindBuffer(GL_ARRAY_BUFFER, renderer->valueBuffer);
+            glBufferSubData(GL_ARRAY_BUFFER, sizeof(float) * (size_t)packed, sizeof(float) * (size_t)n,
+                            state->values + first[r]);
+        }
+        packed += n;
+    }
+
+    GLuint framebuffer = beginSplat(renderer, camera, renderer->positionBuffer, 0, renderer->radiusBuffer, 0,
+                                    withValues ? renderer->valueBuffer : 0, 0);
+    if (packed > 0) {
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, packed);
+    }
+    resolveField(renderer, state, mode, framebuffer, viewportWidth, viewportHeight);
+}
+
+void HeatmapRenderer_DrawStream(HeatmapRenderer* renderer, const StreamBuffer* stream, const SnapshotSlot* state,
+                                const Camera2D* camera, HeatmapMode mode, int viewportWidth, int viewportHeight) {
+    if (!state->hasValues) {
+        mode = HEATMAP_DENSITY;
+    }
+    int first[RENDER_MAX_RANGES], count[RENDER_MAX_RANGES];
+    int numRanges = visibleRanges(state, camera, splatMargin(renderer, state, camera), first, count);
+
+    // The state's arrays are in the region already, each visible run is splatted where it lies
+    const char* region = StreamBuffer_Region(stream, state->index);
+    size_t offset = StreamBuffer_Offset(stream, state->index);
+    GLuint framebuffer = beginSplat(renderer, camera,
+                                    stream->buffer, offset + (size_t)((const char*)state->positions - region),
+                                    stream->buffer, offset + (size_t)((const char*)state->radii - region),
+                                    mode != HEATMAP_DENSITY ? stream->buffer : 0,
+                                    offset + (size_t)((const char*)state->values - region));
+    for (int r = 0; r < numRanges; r++) {
+        glDrawArraysInstancedBaseInstance(GL_TRIANGLE_STRIP, 0, 4, count[r], (GLuint)first[r]);
+    }
+    resolveField(renderer, state, mode, framebuffer, viewportWidth, viewportHeight);
+}
+
+void HeatmapRenderer_Destroy(HeatmapRenderer* renderer) {
+    glDeleteFramebuffers(1, &renderer->framebuffer);
+    glDeleteTextures(1, &renderer->fieldTexture);
+    glDeleteVertexArrays(1, &renderer->splatVAO);
+    glDeleteVertexArrays(1, &renderer->fieldVAO);
+    glDeleteBuffers(1, &renderer->cornerBuffer);
+    glDeleteBuffers(1, &renderer->positionBuffer);
+    glDeleteBuffers(1, &renderer->radiusBuffer);
+    glDeleteBuffers(1, &renderer->valueBuffer);
+    glDeleteProgram(renderer->splatProgram);
+    glDeleteProgram(renderer->colorProgram);
+}
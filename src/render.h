@@ -0,0 +1,155 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+#include "../include/glad/glad.h"
+#include "snapshot.h"
+
+// Compile and link a vertex/fragment shader pair, exits with the info log on errors
+GLuint Render_CreateProgram(const char* vertexSource, const char* fragmentSource);
+
+#define STREAM_MAX_REGIONS 8
+
+// Vertex buffer mapped once, persistently and coherently, and split into regions the CPU fills
+// while the GPU reads others. A fence after the last draw from a region guards it until the GPU
+// is done with it, so writers never stall the driver and nothing is copied per frame.
+typedef struct {
+    GLuint buffer;
+    char* mapped;
+    size_t regionSize;
+    int numRegions;
+    GLsync fences[STREAM_MAX_REGIONS];
+} StreamBuffer;
+
+int StreamBuffer_Init(StreamBuffer* stream, size_t regionSize, int numRegions);
+
+// CPU address of a region, stays valid until StreamBuffer_Destroy
+void* StreamBuffer_Region(const StreamBuffer* stream, int region);
+
+// Byte offset of a region in the buffer, for vertex attribute pointers
+size_t StreamBuffer_Offset(const StreamBuffer* stream, int region);
+
+// Mark the region as read by the draws issued so far
+void StreamBuffer_Fence(StreamBuffer* stream, int region);
+
+// Block until the GPU has finished the draws fenced on the region, call before rewriting it
+void StreamBuffer_Wait(StreamBuffer* stream, int region);
+
+void StreamBuffer_Destroy(StreamBuffer* stream);
+
+// View of the simulation: the world point (centerX, centerY) sits in the middle of the viewport
+// and one world unit spans zoom clip units, so zoom 1 shows the original [-1, 1] domain
+typedef struct {
+    float centerX, centerY;
+    float zoom;
+} Camera2D;
+
+void Camera2D_Reset(Camera2D* camera);
+
+// Move the view along with a drag of (dx, dy) in clip coordinates
+void Camera2D_Pan(Camera2D* camera, float dx, float dy);
+
+// Scale the zoom by factor, keeping the world point under clip position (x, y) in place
+void Camera2D_ZoomAt(Camera2D* camera, float factor, float x, float y);
+
+// World-space rectangle the viewport shows
+void Camera2D_Bounds(const Camera2D* camera, float* minX, float* minY, float* maxX, float* maxY);
+
+// Particles drawn as one instanced quad each. The fragment shader cuts the disc out of the quad
+// and anti-aliases its edge analytically, so a particle costs 4 vertices whatever its size.
+// Only the grid cells of the state that overlap the view are submitted.
+typedef struct {
+    GLuint program;
+    GLint pixelSizeLocation;
+    GLint viewLocation;
+    GLuint VAO;
+    GLuint cornerBuffer;      // unit quad shared by every instance
+    GLuint positionBuffer;    // x, y per visible instance, refilled every frame
+    GLuint radiusBuffer;      // radius per visible instance, refilled every frame
+    int capacity;             // instances the buffers hold
+} ImpostorRenderer;
+
+void ImpostorRenderer_Init(ImpostorRenderer* renderer, int capacity);
+
+// Copy the visible particles of the state into the instance buffers and draw them
+void ImpostorRenderer_Draw(ImpostorRenderer* renderer, const SnapshotSlot* state, const Camera2D* camera,
+                           int viewportWidth, int viewportHeight);
+
+// Draw the visible particles of a state that lives in a region of a stream buffer, in place
+void ImpostorRenderer_DrawStream(ImpostorRenderer* renderer, const StreamBuffer* stream, const SnapshotSlot* state,
+                                 const Camera2D* camera, int viewportWidth, int viewportHeight);
+
+void ImpostorRenderer_Destroy(ImpostorRenderer* renderer);
+
+#define MESH_LOD_LEVELS 5
+#define MESH_MAX_SEGMENTS 100
+
+// Particles drawn as instanced triangle fans with a segment count picked from their on-screen
+// radius, so the chord error stays under a quarter pixel. Each frame the visible particles are
+// bucketed by level and every level is one instanced draw.
+typedef struct {
+    GLuint program;
+    GLint viewLocation;
+    GLuint VAO;
+    GLuint fanBuffer;         // unit circle fans of every level, one after the other
+    GLuint instanceBuffer;    // x, y, radius per instance, grouped by level
+    int segments[MESH_LOD_LEVELS];
+    int firstVertex[MESH_LOD_LEVELS];
+    int levelCounts[MESH_LOD_LEVELS];   // instances per level in the last frame
+    float* instances;         // staging copy of the instance buffer
+    unsigned char* levels;    // level of every visible particle in the last frame
+    int capacity;
+} MeshRenderer;
+
+int MeshRenderer_Init(MeshRenderer* renderer, int capacity);
+
+// pixelsPerUnit converts a radius at zoom 1 to on-screen pixels and drives the level selection
+void MeshRenderer_Draw(MeshRenderer* renderer, const SnapshotSlot* state, const Camera2D* camera,
+                       float pixelsPerUnit);
+
+void MeshRenderer_Destroy(MeshRenderer* renderer);
+
+typedef enum {
+    HEATMAP_OFF,
+    HEATMAP_DENSITY,    // covered fraction of the area, from positions and radii alone
+    HEATMAP_SPEED,      // local mean of the published values, the caller publishes speeds
+    HEATMAP_PRESSURE,   // the same, over published pressures
+    HEATMAP_NUM_MODES
+} HeatmapMode;
+
+// Field view of the state in place of the particles. Every visible particle is splatted with a
+// smooth kernel into a low-resolution float texture with additive blending, accumulating its
+// covered area and area-weighted value; one fullscreen pass then colour-maps the texture. The
+// fill cost is tied to the texture resolution, so very large N costs little more than the splat.
+typedef struct {
+    GLuint splatProgram;
+    GLint splatViewLocation;
+    GLint texelSizeLocation;
+    GLuint colorProgram;
+    GLint modeLocation;
+    GLint rangeLocation;
+    GLuint splatVAO;
+    GLuint fieldVAO;          // no attributes, the fullscreen triangle comes from gl_VertexID
+    GLuint cornerBuffer;
+    GLuint positionBuffer;    // instance buffers of the copy path, as for the impostors
+    GLuint radiusBuffer;
+    GLuint valueBuffer;
+    GLuint framebuffer;
+    GLuint fieldTexture;      // RG32F: sum of weights, sum of weighted values
+    int resolution;           // texels per side of the field over the viewport
+    int capacity;
+} HeatmapRenderer;
+
+int HeatmapRenderer_Init(HeatmapRenderer* renderer, int capacity, int resolution);
+
+// Falls back to HEATMAP_DENSITY for states published without values
+void HeatmapRenderer_Draw(HeatmapRenderer* renderer, const SnapshotSlot* state, const Camera2D* camera,
+                          HeatmapMode mode, int viewportWidth, int viewportHeight);
+
+// Splat a state that lives in a region of a stream buffer, in place
+void HeatmapRenderer_DrawStream(HeatmapRenderer* renderer, const StreamBuffer* stream, const SnapshotSlot* state,
+                                const Camera2D* camera, HeatmapMode mode, int viewportWidth, int viewportHeight);
+
+void HeatmapRenderer_Destroy(HeatmapRenderer* renderer);
+
+#endif // RENDER_H
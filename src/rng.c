@@ -0,0 +1,26 @@
+#include "rng.h"
+
+#define GOLDEN_GAMMA 0x9E3779B97F4A7C15ULL
+
+// SplitMix64 finaliser, a bijection with full avalanche
+static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// The key is mixed from seed and stream, then each half of the counter goes through its own round
+// so nearby (particle, step) pairs land on unrelated outputs
+uint64_t Rng_Bits(uint64_t seed, RngStream stream, uint64_t particle, uint64_t step) {
+    uint64_t key = mix(seed + GOLDEN_GAMMA * ((uint64_t)stream + 1));
+    uint64_t z = mix(key ^ (step * GOLDEN_GAMMA));
+    return mix(z + particle * 0xD1B54A32D192ED03ULL);
+}
+
+float Rng_Uniform(uint64_t seed, RngStream stream, uint64_t particle, uint64_t step) {
+    return (float)(Rng_Bits(seed, stream, particle, step) >> 40) * (1.0f / 16777216.0f);
+}
+
+float Rng_Signed(uint64_t seed, RngStream stream, uint64_t particle, uint64_t step) {
+    return (float)(Rng_Bits(seed, stream, particle, step) >> 40) * (2.0f / 16777216.0f) - 1.0f;
+}
@@ -0,0 +1,27 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// Counter-based random numbers: each value is a pure function of (seed, stream, particle, step),
+// with no state carried between calls. Results don't depend on the order particles are visited in
+// or on how they are split across threads, and any value can be regenerated after a restart.
+typedef enum {
+    RNG_STREAM_VELOCITY_X,    // initial velocities
+    RNG_STREAM_VELOCITY_Y,
+    RNG_STREAM_JITTER_X,      // scene lattice jitter
+    RNG_STREAM_JITTER_Y,
+    RNG_STREAM_FORCING_X,     // per-step random forcing
+    RNG_STREAM_FORCING_Y,
+    RNG_STREAM_SCENE_NOISE    // scene noise velocity fields, field f draws x from this + 2f and y from + 2f + 1
+} RngStream;
+
+uint64_t Rng_Bits(uint64_t seed, RngStream stream, uint64_t particle, uint64_t step);
+
+// Uniform in [0, 1)
+float Rng_Uniform(uint64_t seed, RngStream stream, uint64_t particle, uint64_t step);
+
+// Uniform in [-1, 1)
+float Rng_Signed(uint64_t seed, RngStream stream, uint64_t particle, uint64_t step);
+
+#endif // RNG_H
@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "scene.h"
+#include "jobs.h"
+#include "rng.h"
+
+#define GENERATE_GRAIN 16384
+
+static char* readFile(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = length >= 0 ? malloc((size_t)length + 1) : NULL;
+    if (data && fread(data, 1, (size_t)length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    if (data) data[length] = '\0';
+    return data;
+}
+
+// Grow *array to hold one more element of the given size
+static void* appendElement(void** array, int* count, int* capacity, size_t size) {
+    if (*count == *capacity) {
+        int grown = *capacity ? *capacity * 2 : 4;
+        void* resized = realloc(*array, size * grown);
+        if (!resized) return NULL;
+        *array = resized;
+        *capacity = grown;
+    }
+    return (char*)*array + size * (*count)++;
+}
+
+static int readFloats(char** cursor, float* values, int count) {
+    for (int i = 0; i < count; i++) {
+        int consumed;
+        if (sscanf(*cursor, "%f%n", &values[i], &consumed) != 1) return -1;
+        *cursor += consumed;
+    }
+    return 0;
+}
+
+// Consume the next token only if it equals word
+static int acceptWord(char** cursor, const char* word) {
+    char token[32];
+    int consumed;
+    if (sscanf(*cursor, "%31s%n", token, &consumed) != 1 || strcmp(token, word) != 0) return 0;
+    *cursor += consumed;
+    return 1;
+}
+
+static int parseScene(Scene* scene, char* text, SDFPolygon** polygons, int* numPolygons) {
+    int boxCapacity = 0, emitterCapacity = 0, velocityCapacity = 0, polygonCapacity = 0;
+
+    for (char* c = text; *c; c++) {
+        if (*c == '#') {
+            while (*c && *c != '\n') *c++ = ' ';
+            if (!*c) break;
+        }
+    }
+
+    char* cursor = text;
+    char keyword[32];
+    int consumed;
+    while (sscanf(cursor, "%31s%n", keyword, &consumed) == 1) {
+        cursor += consumed;
+        float v[7];
+        if (strcmp(keyword, "gravity") == 0) {
+            if (readFloats(&cursor, v, 1) != 0) goto missing;
+            scene->parameters.gravity = v[0];
+        } else if (strcmp(keyword, "restitution") == 0) {
+            if (readFloats(&cursor, v, 1) != 0) goto missing;
+            scene->parameters.restitution = v[0];
+        } else if (strcmp(keyword, "timestep") == 0) {
+            if (readFloats(&cursor, v, 1) != 0 || v[0] <= 0.0f) goto missing;
+            scene->timestep = v[0];
+        } else if (strcmp(keyword, "timestep_bins") == 0) {
+            if (sscanf(cursor, "%d%n", &scene->parameters.timestepLevels, &consumed) != 1) goto missing;
+            cursor += consumed;
+        } else if (strcmp(keyword, "seed") == 0) {
+            unsigned long long seed;
+            if (sscanf(cursor, "%llu%n", &seed, &consumed) != 1) goto missing;
+            cursor += consumed;
+            scene->parameters.seed = seed;
+        } else if (strcmp(keyword, "forcing") == 0) {
+            if (readFloats(&cursor, v, 1) != 0) goto missing;
+            scene->parameters.forcingAmplitude = v[0];
+        } else if (strcmp(keyword, "periodic") == 0) {
+            char axes[8];
+            if (sscanf(cursor, "%7s%n", axes, &consumed) != 1) goto missing;
+            cursor += consumed;
+            scene->parameters.periodicX = strchr(axes, 'x') != NULL;
+            scene->parameters.periodicY = strchr(axes, 'y') != NULL;
+        } else if (strcmp(keyword, "box") == 0) {
+            if (readFloats(&cursor, v, 6) != 0) goto missing;
+            SceneBox* box = appendElement((void**)&scene->boxes, &scene->numBoxes, &boxCapacity, sizeof(SceneBox));
+            if (!box) return -1;
+            *box = (SceneBox){ fminf(v[0], v[2]), fminf(v[1], v[3]), fmaxf(v[0], v[2]), fmaxf(v[1], v[3]),
+                               v[4], v[5], 0.0f, 0, 0, 0 };
+            if (acceptWord(&cursor, "jitter") && readFloats(&cursor, &box->jitter, 1) != 0) goto missing;
+            if (box->spacing <= 0.0f || box->radius <= 0.0f) {
+                fprintf(stderr, "Scene box %d needs a positive spacing and radius\n", scene->numBoxes);
+                return -1;
+            }
+        } else if (strcmp(keyword, "emitter") == 0) {
+            if (readFloats(&cursor, v, 7) != 0) goto missing;
+            SceneEmitter* emitter = appendElement((void**)&scene->emitters, &scene->numEmitters, &emitterCapacity,
+                                                  sizeof(SceneEmitter));
+            if (!emitter) return -1;
+            *emitter = (SceneEmitter){ v[0], v[1], v[2], v[3], v[4], v[6], (int)v[5] };
+            if (emitter->rate <= 0.0f || emitter->count < 0 || emitter->radius <= 0.0f) {
+                fprintf(stderr, "Scene emitter %d needs a positive rate and radius\n", scene->numEmitters);
+                return -1;
+            }
+        } else if (strcmp(keyword, "velocity") == 0) {
+            SceneVelocity* field = appendElement((void**)&scene->velocities, &scene->numVelocities, &velocityCapacity,
+                                                 sizeof(SceneVelocity));
+            if (!field) return -1;
+            memset(field, 0, sizeof(*field));
+            if (acceptWord(&cursor, "uniform")) {
+                field->type = VELOCITY_UNIFORM;
+                if (readFloats(&cursor, &field->a, 2) != 0) goto missing;
+            } else if (acceptWord(&cursor, "vortex")) {
+                field->type = VELOCITY_VORTEX;
+                if (readFloats(&cursor, &field->a, 3) != 0) goto missing;
+            } else if (acceptWord(&cursor, "noise")) {
+                field->type = VELOCITY_NOISE;
+                if (readFloats(&cursor, &field->a, 1) != 0) goto missing;
+            } else {
+                fprintf(stderr, "Unknown velocity field in scene, expected uniform, vortex or noise\n");
+                return -1;
+            }
+        } else if (strcmp(keyword, "container") == 0 || strcmp(keyword, "obstacle") == 0) {
+            int numVertices;
+            if (sscanf(cursor, "%d%n", &numVertices, &consumed) != 1 || numVertices < 3) goto missing;
+            cursor += consumed;
+            SDFPolygon* polygon = appendElement((void**)polygons, numPolygons, &polygonCapacity, sizeof(SDFPolygon));
+            if (!polygon) return -1;
+            polygon->isObstacle = strcmp(keyword, "obstacle") == 0;
+            polygon->numVertices = numVertices;
+            polygon->vertices = malloc(sizeof(float) * 2 * numVertices);
+            if (!polygon->vertices || readFloats(&cursor, polygon->vertices, 2 * numVertices) != 0) goto missing;
+        } else {
+            fprintf(stderr, "Unknown scene keyword '%s'\n", keyword);
+            return -1;
+        }
+    }
+    return 0;
+
+missing:
+    fprintf(stderr, "Missing or invalid values after '%s' in scene\n", keyword);
+    return -1;
+}
+
+int Scene_Load(Scene* scene, const char* path, int sdfResolution) {
+    memset(scene, 0, sizeof(*scene));
+    getPhysicsParameters(&scene->parameters);
+
+    char* text = readFile(path);
+    if (!text) {
+        fprintf(stderr, "Could not read scene %s\n", path);
+        return -1;
+    }
+    SDFPolygon* polygons = NULL;
+    int numPolygons = 0;
+    int result = parseScene(scene, text, &polygons, &numPolygons);
+    free(text);
+    if (result == 0 && numPolygons > 0) {
+        result = SDFGrid_Build(&scene->boundary, polygons, numPolygons, sdfResolution);
+        scene->hasBoundary = result == 0;
+    }
+    for (int p = 0; p < numPolygons; p++) {
+        free(polygons[p].vertices);
+    }
+    free(polygons);
+
+    // Lay the blocks out one after another, emitted particles follow all of them
+    long long total = 0;
+    for (int b = 0; result == 0 && b < scene->numBoxes; b++) {
+        SceneBox* box = &scene->boxes[b];
+        box->columns = (int)((box->xMax - box->xMin) / box->spacing);
+        box->rows = (int)((box->yMax - box->yMin) / box->spacing);
+        box->firstParticle = (int)total;
+        total += (long long)box->columns * box->rows;
+        if (total > INT32_MAX) result = -1;
+    }
+    scene->numBoxParticles = (int)total;
+    for (int e = 0; result == 0 && e < scene->numEmitters; e++) {
+        total += scene->emitters[e].count;
+        if (total > INT32_MAX) result = -1;
+    }
+    scene->numCircles = (int)total;
+
+    if (result == 0 && total == 0) {
+        fprintf(stderr, "Scene %s has no particles\n", path);
+        result = -1;
+    }
+    if (result != 0) {
+        fprintf(stderr, "Failed to load scene %s\n", path);
+        Scene_Destroy(scene);
+    }
+    return result;
+}
+
+static int emittedBy(const SceneEmitter* emitter, long long step) {
+    double released = floor((double)emitter->rate * (double)step);
+    return released < emitter->count ? (int)released : emitter->count;
+}
+
+int Scene_ActiveCount(const Scene* scene, long long step) {
+    int active = scene->numBoxParticles;
+    for (int e = 0; e < scene->numEmitters; e++) {
+        active += emittedBy(&scene->emitters[e], step);
+    }
+    return active;
+}
+
+typedef struct {
+    const Scene* scene;
+    Circle* circles;
+} GenerateContext;
+
+static void generateBoxRange(int begin, int end, void* context) {
+    const GenerateContext* generate = context;
+    const Scene* scene = generate->scene;
+    uint64_t seed = scene->parameters.seed;
+
+    // Last box starting at or before begin, later boxes are entered as i crosses their first particle
+    int b = 0;
+    int low = 0, high = scene->numBoxes - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        if (scene->boxes[middle].firstParticle <= begin) {
+            b = middle;
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    for (int i = begin; i < end; i++) {
+        while (b + 1 < scene->numBoxes && scene->boxes[b + 1].firstParticle <= i) b++;
+        const SceneBox* box = &scene->boxes[b];
+        int local = i - box->firstParticle;
+        int column = local % box->columns;
+        int row = local / box->columns;
+
+        float jitter = 0.5f * box->jitter * box->spacing;
+        float x = box->xMin + (column + 0.5f) * box->spacing + jitter * Rng_Signed(seed, RNG_STREAM_JITTER_X, (uint64_t)i, 0);
+        float y = box->yMin + (row + 0.5f) * box->spacing + jitter * Rng_Signed(seed, RNG_STREAM_JITTER_Y, (uint64_t)i, 0);
+
+        float vx = 0.0f, vy = 0.0f;
+        for (int f = 0; f < scene->numVelocities; f++) {
+            const SceneVelocity* field = &scene->velocities[f];
+            switch (field->type) {
+                case VELOCITY_UNIFORM:
+                    vx += field->a;
+                    vy += field->b;
+                    break;
+                case VELOCITY_VORTEX:
+                    vx -= field->c * (y - field->b);
+                    vy += field->c * (x - field->a);
+                    break;
+                default: {
+                    // Own streams per field, so two noise fields add up instead of doubling one draw
+                    RngStream streamX = (RngStream)(RNG_STREAM_SCENE_NOISE + 2 * f);
+                    vx += field->a * Rng_Signed(seed, streamX, (uint64_t)i, 0);
+                    vy += field->a * Rng_Signed(seed, (RngStream)(streamX + 1), (uint64_t)i, 0);
+                    break;
+                }
+            }
+        }
+
+        Circle* c = &generate->circles[i];
+        c->xPos = x;
+        c->yPos = y;
+        c->xVelocity = vx;
+        c->yVelocity = vy;
+        c->radius = box->radius;
+    }
+}
+
+void Scene_Generate(const Scene* scene, Circle* circles) {
+    GenerateContext context = { scene, circles };
+    JobSystem_ParallelFor(scene->numBoxParticles, GENERATE_GRAIN, generateBoxRange, &context);
+
+    // Emitted particles in release order, each step's batch spread across the nozzle
+    int next = scene->numBoxParticles;
+    for (long long step = 1; next < scene->numCircles; step++) {
+        for (int e = 0; e < scene->numEmitters; e++) {
+            const SceneEmitter* emitter = &scene->emitters[e];
+            int first = emittedBy(emitter, step - 1);
+            int batch = emittedBy(emitter, step) - first;
+            if (batch == 0) continue;
+
+            float speed = sqrtf(emitter->xVelocity * emitter->xVelocity + emitter->yVelocity * emitter->yVelocity);
+            float nx = speed > 0.0f ? -emitter->yVelocity / speed : 1.0f;
+            float ny = speed > 0.0f ? emitter->xVelocity / speed : 0.0f;
+            for (int k = 0; k < batch; k++) {
+                float offset = (k - 0.5f * (batch - 1)) * 2.0f * emitter->radius;
+                Circle* c = &circles[next++];
+                c->xPos = emitter->x + nx * offset;
+                c->yPos = emitter->y + ny * offset;
+                c->xVelocity = emitter->xVelocity;
+                c->yVelocity = emitter->yVelocity;
+                c->radius = emitter->radius;
+            }
+        }
+    }
+}
+
+void Scene_Destroy(Scene* scene) {
+    free(scene->boxes);
+    free(scene->emitters);
+    free(scene->velocities);
+    if (scene->hasBoundary) SDFGrid_Destroy(&scene->boundary);
+    memset(scene, 0, sizeof(*scene));
+}
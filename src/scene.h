@@ -0,0 +1,73 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include "circle.h"
+#include "sdf.h"
+#include "physics.h"
+
+// Block of particles on a square lattice filling an axis-aligned box
+typedef struct {
+    float xMin, yMin, xMax, yMax;
+    float spacing, radius;
+    float jitter;           // random offset as a fraction of the spacing
+    int columns, rows;
+    int firstParticle;
+} SceneBox;
+
+// Nozzle that releases `rate` particles per step until `count` have been released
+typedef struct {
+    float x, y, xVelocity, yVelocity;
+    float rate, radius;
+    int count;
+} SceneEmitter;
+
+typedef enum {
+    VELOCITY_UNIFORM,       // (a, b)
+    VELOCITY_VORTEX,        // rotation at angular velocity c around (a, b)
+    VELOCITY_NOISE          // random components of amplitude a
+} SceneVelocityType;
+
+// Initial velocity fields, summed at every box particle
+typedef struct {
+    SceneVelocityType type;
+    float a, b, c;
+} SceneVelocity;
+
+// Scene file: keywords followed by their values, one entry per line, '#' starts a comment.
+//   gravity <g>  restitution <e>  timestep <dt>  timestep_bins <levels>  periodic x|y|xy
+//   seed <n>  forcing <amplitude>
+//   box <x0> <y0> <x1> <y1> <spacing> <radius> [jitter <fraction>]
+//   emitter <x> <y> <vx> <vy> <rate> <count> <radius>
+//   velocity uniform <vx> <vy> | velocity vortex <cx> <cy> <omega> | velocity noise <amplitude>
+//   container|obstacle <n> <x1> <y1> ... <xn> <yn>     (boundary polygons, as in .poly files)
+typedef struct {
+    SceneBox* boxes;
+    int numBoxes;
+    SceneEmitter* emitters;
+    int numEmitters;
+    SceneVelocity* velocities;
+    int numVelocities;
+
+    int numBoxParticles;
+    int numCircles;         // box particles plus every particle the emitters will release
+
+    PhysicsParameters parameters;   // the current ones, overridden by the file
+    float timestep;                 // 0 unless the file sets it
+
+    bool hasBoundary;
+    SDFGrid boundary;
+} Scene;
+
+int Scene_Load(Scene* scene, const char* path, int sdfResolution);
+
+// Fill all scene->numCircles particles in parallel. Emitted particles are placed at their nozzle in
+// release order, so they become live simply by the active count growing past them.
+void Scene_Generate(const Scene* scene, Circle* circles);
+
+// Number of particles live after `step` steps, always a prefix of the array
+int Scene_ActiveCount(const Scene* scene, long long step);
+
+void Scene_Destroy(Scene* scene);
+
+#endif // SCENE_H
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "sdf.h"
+
+#define SDF_CACHE_MAGIC "FSDF"
+#define SDF_CACHE_VERSION 1
+#define SDF_MARGIN_CELLS 2
+
+// Header of the on-disk cache, followed by width * height floats
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;   // hash of the scene file contents and resolution
+    int32_t width, height;
+    float xMin, yMin;
+    float cellSize;
+} SDFCacheHeader;
+
+static uint64_t hashBytes(const unsigned char* data, size_t size, uint64_t hash) {
+    // FNV-1a
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static float segmentDistance(float px, float py, float ax, float ay, float bx, float by) {
+    float ex = bx - ax;
+    float ey = by - ay;
+    float wx = px - ax;
+    float wy = py - ay;
+    float lengthSquared = ex * ex + ey * ey;
+    float t = lengthSquared > 0.0f ? (wx * ex + wy * ey) / lengthSquared : 0.0f;
+    if (t < 0.0f) t = 0.0f;
+    if (t > 1.0f) t = 1.0f;
+    float dx = wx - t * ex;
+    float dy = wy - t * ey;
+    return sqrtf(dx * dx + dy * dy);
+}
+
+// Unsigned distance to the polygon outline, negated when (px, py) lies outside of it (even-odd rule)
+static float polygonDistance(const SDFPolygon* polygon, float px, float py) {
+    float distance = INFINITY;
+    int inside = 0;
+    const float* v = polygon->vertices;
+    for (int i = 0, j = polygon->numVertices - 1; i < polygon->numVertices; j = i++) {
+        float ax = v[2 * j], ay = v[2 * j + 1];
+        float bx = v[2 * i], by = v[2 * i + 1];
+        float d = segmentDistance(px, py, ax, ay, bx, by);
+        if (d < distance) distance = d;
+        if ((by > py) != (ay > py) && px < (ax - bx) * (py - by) / (ay - by) + bx) {
+            inside = !inside;
+        }
+    }
+    return inside ? distance : -distance;
+}
+
+int SDFGrid_Build(SDFGrid* grid, const SDFPolygon* polygons, int numPolygons, int resolution) {
+    if (numPolygons <= 0 || resolution < 2) {
+        fprintf(stderr, "SDF needs at least one polygon and a resolution of 2 or more\n");
+        return -1;
+    }
+
+    // Bounds cover the window domain and every polygon, plus a small margin
+    float xMin = -1.0f, yMin = -1.0f, xMax = 1.0f, yMax = 1.0f;
+    for (int p = 0; p < numPolygons; p++) {
+        for (int i = 0; i < polygons[p].numVertices; i++) {
+            float x = polygons[p].vertices[2 * i];
+            float y = polygons[p].vertices[2 * i + 1];
+            if (x < xMin) xMin = x;
+            if (x > xMax) xMax = x;
+            if (y < yMin) yMin = y;
+            if (y > yMax) yMax = y;
+        }
+    }
+    float extent = fmaxf(xMax - xMin, yMax - yMin);
+    float cellSize = extent / (float)(resolution - 1);
+    xMin -= SDF_MARGIN_CELLS * cellSize;
+    yMin -= SDF_MARGIN_CELLS * cellSize;
+
+    grid->width = (int)ceilf((xMax - xMin) / cellSize) + SDF_MARGIN_CELLS + 1;
+    grid->height = (int)ceilf((yMax - yMin) / cellSize) + SDF_MARGIN_CELLS + 1;
+    grid->xMin = xMin;
+    grid->yMin = yMin;
+    grid->cellSize = cellSize;
+    grid->values = malloc(sizeof(float) * grid->width * grid->height);
+    if (!grid->values) {
+        fprintf(stderr, "Failed to allocate memory for SDF grid\n");
+        return -1;
+    }
+
+    for (int row = 0; row < grid->height; row++) {
+        float y = yMin + row * cellSize;
+        for (int col = 0; col < grid->width; col++) {
+            float x = xMin + col * cellSize;
+
+            // The fluid region is inside every container and outside every obstacle
+            float distance = INFINITY;
+            for (int p = 0; p < numPolygons; p++) {
+                float d = polygonDistance(&polygons[p], x, y);
+                if (polygons[p].isObstacle) d = -d;
+                if (d < distance) distance = d;
+            }
+            grid->values[row * grid->width + col] = distance;
+        }
+    }
+    return 0;
+}
+
+static char* readFile(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = length >= 0 ? malloc((size_t)length + 1) : NULL;
+    if (data && fread(data, 1, (size_t)length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    if (!data) return NULL;
+    data[length] = '\0';
+    *size = (size_t)length;
+    return data;
+}
+
+// Scene format: "container <n>" or "obstacle <n>" followed by n "x y" vertex pairs, '#' starts a comment
+static int parseScene(char* text, SDFPolygon** polygons, int* numPolygons) {
+    int capacity = 8;
+    *numPolygons = 0;
+    *polygons = malloc(sizeof(SDFPolygon) * capacity);
+    if (!*polygons) return -1;
+
+    // Strip comments so the remaining text is just whitespace separated tokens
+    for (char* c = text; *c; c++) {
+        if (*c == '#') {
+            while (*c && *c != '\n') *c++ = ' ';
+            if (!*c) break;
+        }
+    }
+
+    char* cursor = text;
+    char keyword[32];
+    int numVertices, consumed;
+    while (sscanf(cursor, "%31s %d%n", keyword, &numVertices, &consumed) == 2) {
+        cursor += consumed;
+        int isObstacle = strcmp(keyword, "obstacle") == 0;
+        if ((!isObstacle && strcmp(keyword, "container") != 0) || numVertices < 3) {
+            fprintf(stderr, "Invalid polygon '%s' with %d vertices in scene\n", keyword, numVertices);
+            return -1;
+        }
+        if (*numPolygons == capacity) {
+            capacity *= 2;
+            SDFPolygon* grown = realloc(*polygons, sizeof(SDFPolygon) * capacity);
+            if (!grown) return -1;
+            *polygons = grown;
+        }
+        SDFPolygon* polygon = &(*polygons)[(*numPolygons)++];
+        polygon->isObstacle = isObstacle;
+        polygon->numVertices = numVertices;
+        polygon->vertices = malloc(sizeof(float) * 2 * numVertices);
+        if (!polygon->vertices) return -1;
+        for (int i = 0; i < 2 * numVertices; i++) {
+            if (sscanf(cursor, "%f%n", &polygon->vertices[i], &consumed) != 1) {
+                fprintf(stderr, "Polygon %d in scene is missing vertices\n", *numPolygons);
+                return -1;
+            }
+            cursor += consumed;
+        }
+    }
+    return *numPolygons > 0 ? 0 : -1;
+}
+
+static int loadCache(SDFGrid* grid, const char* cachePath, uint64_t sourceHash) {
+    FILE* file = fopen(cachePath, "rb");
+    if (!file) return -1;
+
+    SDFCacheHeader header;
+    int ok = fread(&header, sizeof(header), 1, file) == 1 &&
+             memcmp(header.magic, SDF_CACHE_MAGIC, 4) == 0 &&
+             header.version == SDF_CACHE_VERSION &&
+             header.sourceHash == sourceHash &&
+             header.width > 0 && header.height > 0;
+    if (ok) {
+        size_t count = (size_t)header.width * header.height;
+        grid->values = malloc(sizeof(float) * count);
+        ok = grid->values && fread(grid->values, sizeof(float), count, file) == count;
+        if (!ok) {
+            free(grid->values);
+            grid->values = NULL;
+        }
+    }
+    fclose(file);
+    if (!ok) return -1;
+
+    grid->width = header.width;
+    grid->height = header.height;
+    grid->xMin = header.xMin;
+    grid->yMin = header.yMin;
+    grid->cellSize = header.cellSize;
+    return 0;
+}
+
+static void saveCache(const SDFGrid* grid, const char* cachePath, uint64_t sourceHash) {
+    FILE* file = fopen(cachePath, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not write SDF cache %s\n", cachePath);
+        return;
+    }
+    SDFCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SDF_CACHE_MAGIC, 4);
+    header.version = SDF_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.width = grid->width;
+    header.height = grid->height;
+    header.xMin = grid->xMin;
+    header.yMin = grid->yMin;
+    header.cellSize = grid->cellSize;
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(grid->values, sizeof(float), (size_t)grid->width * grid->height, file);
+    fclose(file);
+}
+
+int SDFGrid_LoadScene(SDFGrid* grid, const char* scenePath, int resolution) {
+    size_t size;
+    char* text = readFile(scenePath, &size);
+    if (!text) {
+        fprintf(stderr, "Could not read boundary scene %s\n", scenePath);
+        return -1;
+    }
+
+    uint64_t sourceHash = hashBytes((const unsigned char*)text, size, 14695981039346656037ULL);
+    sourceHash = hashBytes((const unsigned char*)&resolution, sizeof(resolution), sourceHash);
+
+    char cachePath[1024];
+    snprintf(cachePath, sizeof(cachePath), "%s.sdf", scenePath);
+    if (loadCache(grid, cachePath, sourceHash) == 0) {
+        free(text);
+        return 0;
+    }
+
+    SDFPolygon* polygons = NULL;
+    int numPolygons = 0;
+    int result = parseScene(text, &polygons, &numPolygons);
+    if (result == 0) {
+        result = SDFGrid_Build(grid, polygons, numPolygons, resolution);
+    } else {
+        fprintf(stderr, "Failed to parse boundary scene %s\n", scenePath);
+    }
+    if (result == 0) {
+        saveCache(grid, cachePath, sourceHash);
+    }
+
+    for (int p = 0; p < numPolygons; p++) {
+        free(polygons[p].vertices);
+    }
+    free(polygons);
+    free(text);
+    return result;
+}
+
+float SDFGrid_Sample(const SDFGrid* grid, float x, float y, float* gx, float* gy) {
+    float fx = (x - grid->xMin) / grid->cellSize;
+    float fy = (y - grid->yMin) / grid->cellSize;
+
+    // Clamp to the last full cell, positions outside the grid reuse the border values
+    float maxX = (float)(grid->width - 2);
+    float maxY = (float)(grid->height - 2);
+    fx = fx < 0.0f ? 0.0f : (fx > maxX + 1.0f ? maxX + 1.0f : fx);
+    fy = fy < 0.0f ? 0.0f : (fy > maxY + 1.0f ? maxY + 1.0f : fy);
+    int col = (int)fx;
+    int row = (int)fy;
+    if (col > (int)maxX) col = (int)maxX;
+    if (row > (int)maxY) row = (int)maxY;
+    float tx = fx - col;
+    float ty = fy - row;
+
+    const float* v = &grid->values[row * grid->width + col];
+    float d00 = v[0];
+    float d10 = v[1];
+    float d01 = v[grid->width];
+    float d11 = v[grid->width + 1];
+
+    // Gradient of the bilinear interpolant inside the cell
+    if (gx) *gx = ((d10 - d00) * (1.0f - ty) + (d11 - d01) * ty) / grid->cellSize;
+    if (gy) *gy = ((d01 - d00) * (1.0f - tx) + (d11 - d10) * tx) / grid->cellSize;
+
+    float bottom = d00 + (d10 - d00) * tx;
+    float top = d01 + (d11 - d01) * tx;
+    return bottom + (top - bottom) * ty;
+}
+
+void SDFGrid_Destroy(SDFGrid* grid) {
+    free(grid->values);
+    grid->values = NULL;
+    grid->width = grid->height = 0;
+}
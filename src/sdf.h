@@ -0,0 +1,32 @@
+#ifndef SDF_H
+#define SDF_H
+
+// Closed polygon used to describe container walls and obstacles
+typedef struct {
+    float* vertices;   // x,y pairs in NDC, numVertices * 2 floats
+    int numVertices;
+    int isObstacle;    // 0: fluid lives inside (container), 1: fluid lives outside
+} SDFPolygon;
+
+// Signed distance to the boundary sampled on a regular grid.
+// Positive inside the fluid region, negative inside walls/obstacles.
+typedef struct {
+    int width, height;     // number of samples along x and y
+    float xMin, yMin;      // world position of sample (0, 0)
+    float cellSize;        // distance between neighbouring samples
+    float* values;         // width * height distances, row major
+} SDFGrid;
+
+// Bake the distance field of the given polygons, resolution = samples along the longest side
+int SDFGrid_Build(SDFGrid* grid, const SDFPolygon* polygons, int numPolygons, int resolution);
+
+// Load a polygon scene file, reusing "<scenePath>.sdf" if it was baked from the same file
+int SDFGrid_LoadScene(SDFGrid* grid, const char* scenePath, int resolution);
+
+// Bilinear lookup of the distance at (x, y); gradient written to gx/gy if not NULL
+float SDFGrid_Sample(const SDFGrid* grid, float x, float y, float* gx, float* gy);
+
+// Free the sample storage
+void SDFGrid_Destroy(SDFGrid* grid);
+
+#endif // SDF_H
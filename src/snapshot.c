@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "snapshot.h"
+
+#define SNAPSHOT_FRESH 0x100
+#define SNAPSHOT_INDEX 0xff
+#define SNAPSHOT_CELLS (SNAPSHOT_GRID * SNAPSHOT_GRID)
+#define SNAPSHOT_OUTSIDE SNAPSHOT_CELLS    // bin of the particles outside the window
+
+static int allocateGrid(StateSnapshot* snapshot, int capacity, int numSlots) {
+    snapshot->cells = malloc(sizeof(int) * (size_t)capacity);
+    snapshot->cellCursor = malloc(sizeof(int) * (SNAPSHOT_CELLS + 1));
+    if (!snapshot->cells || !snapshot->cellCursor) {
+        return -1;
+    }
+    for (int s = 0; s < numSlots; s++) {
+        snapshot->slots[s].cellStart = calloc(SNAPSHOT_CELLS + 2, sizeof(int));
+        if (!snapshot->slots[s].cellStart) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void assignSlots(StateSnapshot* snapshot, int capacity, int numSlots) {
+    snapshot->capacity = capacity;
+    snapshot->numSlots = numSlots;
+    for (int s = 0; s < numSlots; s++) {
+        snapshot->slots[s].index = s;
+    }
+    snapshot->front = 0;
+    atomic_init(&snapshot->middle, 1);
+    snapshot->back = 2;
+    snapshot->numRetired = 0;
+    for (int s = 3; s < numSlots; s++) {
+        snapshot->retired[snapshot->numRetired++] = s;
+    }
+}
+
+int Snapshot_Init(StateSnapshot* snapshot, int capacity) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->ownsPositions = true;
+    snapshot->numSlots = 3;
+    for (int s = 0; s < 3; s++) {
+        snapshot->slots[s].positions = calloc((size_t)capacity * 2, sizeof(float));
+        snapshot->slots[s].radii = calloc((size_t)capacity, sizeof(float));
+        snapshot->slots[s].values = calloc((size_t)capacity, sizeof(float));
+        if (!snapshot->slots[s].positions || !snapshot->slots[s].radii || !snapshot->slots[s].values) {
+            fprintf(stderr, "Failed to allocate memory for state snapshot\n");
+            Snapshot_Destroy(snapshot);
+            return -1;
+        }
+    }
+    if (allocateGrid(snapshot, capacity, 3) != 0) {
+        fprintf(stderr, "Failed to allocate memory for state snapshot\n");
+        Snapshot_Destroy(snapshot);
+        return -1;
+    }
+    assignSlots(snapshot, capacity, 3);
+    return 0;
+}
+
+int Snapshot_InitMapped(StateSnapshot* snapshot, int capacity, float* const* positions, float* const* radii,
+                        float* const* values, int numSlots, SnapshotReleaseFn release, void* releaseContext) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    if (numSlots < 3 || numSlots > SNAPSHOT_MAX_SLOTS) {
+        fprintf(stderr, "State snapshot needs 3 to %d slots, got %d\n", SNAPSHOT_MAX_SLOTS, numSlots);
+        return -1;
+    }
+    snapshot->numSlots = numSlots;
+    for (int s = 0; s < numSlots; s++) {
+        snapshot->slots[s].positions = positions[s];
+        snapshot->slots[s].radii = radii[s];
+        snapshot->slots[s].values = values[s];
+    }
+    if (allocateGrid(snapshot, capacity, numSlots) != 0) {
+        fprintf(stderr, "Failed to allocate memory for state snapshot\n");
+        Snapshot_Destroy(snapshot);
+        return -1;
+    }
+    snapshot->release = release;
+    snapshot->releaseContext = releaseContext;
+    assignSlots(snapshot, capacity, numSlots);
+    return 0;
+}
+
+SnapshotSlot* Snapshot_BeginWrite(StateSnapshot* snapshot) {
+    return &snapshot->slots[snapshot->back];
+}
+
+void Snapshot_Fill(StateSnapshot* snapshot, SnapshotSlot* slot, const Circle* circles, const float* values,
+                   int count) {
+    // Fixed grid over the window, so a stray particle can't stretch the cells of everyone else
+    float cellSize = SNAPSHOT_DOMAIN_SIZE / SNAPSHOT_GRID;
+    float inverseCell = 1.0f / cellSize;
+
+    // Counting sort by cell, stable so equal states publish identical orders
+    int* cellStart = slot->cellStart;
+    memset(cellStart, 0, sizeof(int) * (SNAPSHOT_CELLS + 2));
+    float maxRadius = 0.0f;
+    for (int i = 0; i < count; i++) {
+        float x = (circles[i].xPos - SNAPSHOT_DOMAIN_MIN) * inverseCell;
+        float y = (circles[i].yPos - SNAPSHOT_DOMAIN_MIN) * inverseCell;
+        int inside = x >= 0.0f && x <= SNAPSHOT_GRID && y >= 0.0f && y <= SNAPSHOT_GRID;
+        int cx = inside ? (int)x : 0;
+        int cy = inside ? (int)y : 0;
+        cx = cx < SNAPSHOT_GRID ? cx : SNAPSHOT_GRID - 1;   // the upper walls belong to the last cells
+        cy = cy < SNAPSHOT_GRID ? cy : SNAPSHOT_GRID - 1;
+        snapshot->cells[i] = inside ? cy * SNAPSHOT_GRID + cx : SNAPSHOT_OUTSIDE;
+        cellStart[snapshot->cells[i] + 1]++;
+        maxRadius = fmaxf(maxRadius, circles[i].radius);
+    }
+    for (int c = 0; c <= SNAPSHOT_CELLS; c++) {
+        cellStart[c + 1] += cellStart[c];
+    }
+    memcpy(snapshot->cellCursor, cellStart, sizeof(int) * (SNAPSHOT_CELLS + 1));
+    float maxValue = 0.0f;
+    for (int i = 0; i < count; i++) {
+        int target = snapshot->cellCursor[snapshot->cells[i]]++;
+        slot->positions[2 * target] = circles[i].xPos;
+        slot->positions[2 * target + 1] = circles[i].yPos;
+        slot->radii[target] = circles[i].radius;
+        if (values) {
+            slot->values[target] = values[i];
+            maxValue = fmaxf(maxValue, values[i]);
+        }
+    }
+
+    slot->count = count;
+    slot->hasValues = values != NULL;
+    slot->maxValue = maxValue;
+    slot->gridMinX = SNAPSHOT_DOMAIN_MIN;
+    slot->gridMinY = SNAPSHOT_DOMAIN_MIN;
+    slot->cellSize = cellSize;
+    slot->maxRadius = maxRadius;
+}
+
+void Snapshot_Publish(StateSnapshot* snapshot) {
+    int previous = atomic_exchange_explicit(&snapshot->middle, snapshot->back | SNAPSHOT_FRESH,
+                                            memory_order_acq_rel);
+    snapshot->back = previous & SNAPSHOT_INDEX;
+}
+
+const SnapshotSlot* Snapshot_Latest(StateSnapshot* snapshot) {
+    if (atomic_load_explicit(&snapshot->middle, memory_order_relaxed) & SNAPSHOT_FRESH) {
+        // Retire the front and hand the oldest retired slot to the writer, once nothing reads it
+        int oldest = snapshot->front;
+        if (snapshot->numRetired > 0) {
+            oldest = snapshot->retired[0];
+            memmove(snapshot->retired, snapshot->retired + 1, sizeof(int) * (snapshot->numRetired - 1));
+            snapshot->retired[snapshot->numRetired - 1] = snapshot->front;
+        }
+        if (snapshot->release) {
+            snapshot->release(oldest, snapshot->releaseContext);
+        }
+        int previous = atomic_exchange_explicit(&snapshot->middle, oldest, memory_order_acq_rel);
+        snapshot->front = previous & SNAPSHOT_INDEX;
+    }
+    return &snapshot->slots[snapshot->front];
+}
+
+// Clamped grid coordinate of a position along one axis
+static int gridCell(float value, float origin, float cellSize) {
+    float cell = floorf((value - origin) / cellSize);
+    return cell < 0.0f ? 0 : cell >= SNAPSHOT_GRID ? SNAPSHOT_GRID - 1 : (int)cell;
+}
+
+// Add [begin, end) to the runs, joined to the last run when they meet
+static int appendRange(int* first, int* count, int numRanges, int maxRanges, int begin, int end) {
+    if (begin == end) {
+        return numRanges;
+    }
+    if (numRanges > 0 && first[numRanges - 1] + count[numRanges - 1] == begin) {
+        count[numRanges - 1] += end - begin;
+    } else if (numRanges < maxRanges) {
+        first[numRanges] = begin;
+        count[numRanges] = end - begin;
+        numRanges++;
+    } else {
+        // Out of room, let the last run cover everything up to here
+        count[numRanges - 1] = end - first[numRanges - 1];
+    }
+    return numRanges;
+}
+
+int Snapshot_Ranges(const SnapshotSlot* slot, float minX, float minY, float maxX, float maxY,
+                    int* first, int* count, int maxRanges) {
+    if (maxRanges <= 0 || slot->count <= 0) {
+        return 0;
+    }
+    if (!slot->cellStart) {
+        first[0] = 0;
+        count[0] = slot->count;
+        return 1;
+    }
+    int numRanges = 0;
+    float gridMax = SNAPSHOT_GRID * slot->cellSize;
+    if (maxX >= slot->gridMinX && maxY >= slot->gridMinY &&
+        minX <= slot->gridMinX + gridMax && minY <= slot->gridMinY + gridMax) {
+        int x0 = gridCell(minX, slot->gridMinX, slot->cellSize);
+        int x1 = gridCell(maxX, slot->gridMinX, slot->cellSize);
+        int y0 = gridCell(minY, slot->gridMinY, slot->cellSize);
+        int y1 = gridCell(maxY, slot->gridMinY, slot->cellSize);
+        for (int y = y0; y <= y1; y++) {
+            numRanges = appendRange(first, count, numRanges, maxRanges, slot->cellStart[y * SNAPSHOT_GRID + x0],
+                                    slot->cellStart[y * SNAPSHOT_GRID + x1 + 1]);
+        }
+    }
+    // Particles outside the window are few and not binned, so they are always drawn
+    return appendRange(first, count, numRanges, maxRanges, slot->cellStart[SNAPSHOT_OUTSIDE],
+                       slot->cellStart[SNAPSHOT_OUTSIDE + 1]);
+}
+
+void Snapshot_Destroy(StateSnapshot* snapshot) {
+    for (int s = 0; s < snapshot->numSlots; s++) {
+        if (snapshot->ownsPositions) {
+            free(snapshot->slots[s].positions);
+            free(snapshot->slots[s].radii);
+            free(snapshot->slots[s].values);
+        }
+        free(snapshot->slots[s].cellStart);
+        snapshot->slots[s].positions = NULL;
+        snapshot->slots[s].radii = NULL;
+        snapshot->slots[s].values = NULL;
+        snapshot->slots[s].cellStart = NULL;
+    }
+    free(snapshot->cells);
+    free(snapshot->cellCursor);
+    snapshot->cells = NULL;
+    snapshot->cellCursor = NULL;
+}
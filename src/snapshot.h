@@ -0,0 +1,86 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "circle.h"
+
+#define SNAPSHOT_MAX_SLOTS 8
+#define SNAPSHOT_GRID 64       // cells per side of the grid published states are sorted into
+#define SNAPSHOT_DOMAIN_MIN -1.0f   // the grid covers the simulation window [-1, 1] on both axes
+#define SNAPSHOT_DOMAIN_SIZE 2.0f
+
+// One published simulation state: interleaved x,y positions and the radii of every particle, and
+// optionally one scalar per particle (speed or pressure) for the heatmaps.
+// States written by Snapshot_Fill are sorted by cell of a grid over the simulation window, so a
+// reader can find the particles inside a rectangle without looking at the others. Particles
+// outside the window come last, in one extra bin that every query returns.
+typedef struct {
+    float* positions;
+    float* radii;
+    float* values;
+    bool hasValues;        // values were published with this state
+    float maxValue;
+    int count;
+    long long step;
+    int index;             // slot number, -1 for states that don't come from a snapshot
+    int* cellStart;        // SNAPSHOT_GRID^2 + 2 offsets into the particles (the last bin is outside
+                           // the window), NULL when not sorted
+    float gridMinX, gridMinY, cellSize;
+    float maxRadius;
+} SnapshotSlot;
+
+// Called by the reader before a slot it has drawn from goes back to the writer
+typedef void (*SnapshotReleaseFn)(int slot, void* context);
+
+// Lock-free buffer between the physics thread (writer) and the render thread (reader).
+// The writer fills the back slot and swaps it with the middle one, the reader swaps the middle
+// slot into the front whenever a newer state was published, so neither side ever waits.
+// With more than three slots the reader retires fronts into a queue and hands the writer the
+// oldest one, giving whatever still reads a retired slot (the GPU) time to finish.
+typedef struct {
+    SnapshotSlot slots[SNAPSHOT_MAX_SLOTS];
+    int numSlots;
+    int capacity;
+    bool ownsPositions;
+    atomic_int middle;     // slot index, SNAPSHOT_FRESH set when it holds an unread state
+    int back;              // owned by the writer
+    int front;             // owned by the reader
+    int retired[SNAPSHOT_MAX_SLOTS];   // owned by the reader, oldest first
+    int numRetired;
+    SnapshotReleaseFn release;
+    void* releaseContext;
+    int* cells;            // writer scratch: cell of every particle
+    int* cellCursor;       // writer scratch: next free position in every cell
+} StateSnapshot;
+
+// Three slots allocated on the heap
+int Snapshot_Init(StateSnapshot* snapshot, int capacity);
+
+// numSlots (3 to SNAPSHOT_MAX_SLOTS) slots over caller-owned arrays of 2 * capacity positions and
+// capacity radii and values, such as the regions of a mapped GL buffer. release may be NULL.
+int Snapshot_InitMapped(StateSnapshot* snapshot, int capacity, float* const* positions, float* const* radii,
+                        float* const* values, int numSlots, SnapshotReleaseFn release, void* releaseContext);
+
+// Slot the writer may fill, then pass to Snapshot_Publish
+SnapshotSlot* Snapshot_BeginWrite(StateSnapshot* snapshot);
+
+// Sort the circles into the slot's grid, writing their positions and radii in cell order. values
+// holds one scalar per circle in circle order and goes along with them, or is NULL for none.
+void Snapshot_Fill(StateSnapshot* snapshot, SnapshotSlot* slot, const Circle* circles, const float* values,
+                   int count);
+
+void Snapshot_Publish(StateSnapshot* snapshot);
+
+// Latest complete state, stays valid until the next call from the reader
+const SnapshotSlot* Snapshot_Latest(StateSnapshot* snapshot);
+
+// Contiguous runs of particles whose cells overlap the rectangle: one per grid row, merged where
+// rows join up, plus the particles outside the window, or the whole state when it isn't sorted.
+// Returns the number of runs written.
+int Snapshot_Ranges(const SnapshotSlot* slot, float minX, float minY, float maxX, float maxY,
+                    int* first, int* count, int maxRanges);
+
+void Snapshot_Destroy(StateSnapshot* snapshot);
+
+#endif // SNAPSHOT_H
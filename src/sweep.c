@@ -0,0 +1,320 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include "sweep.h"
+#include "ensemble.h"
+#include "jobs.h"
+
+#define MAX_SWEEP_VALUES 64
+#define SWEEP_GRID_LENGTH 100
+#define SWEEP_SPACING 0.004f
+
+typedef struct {
+    float values[MAX_SWEEP_VALUES];
+    int count;
+} SweepAxis;
+
+typedef struct {
+    SweepAxis gravity, restitution, radius, timestep;
+    int particles, steps, seeds;
+} SweepSpec;
+
+typedef struct {
+    int id;
+    unsigned int seed;
+    float gravity, restitution, radius, timestep;
+} SweepRun;
+
+typedef struct {
+    const SweepSpec* spec;
+    const SweepRun* runs;
+    const int* pendingRuns;    // ids of the runs still to do
+    FILE* results;
+    pthread_mutex_t resultsLock;
+    int finished, failed, pending;    // finished counts failed runs too
+} Sweep;
+
+static void setAxis(SweepAxis* axis, float value) {
+    axis->values[0] = value;
+    axis->count = 1;
+}
+
+static int parseSpec(const char* path, SweepSpec* spec) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not read sweep specification %s\n", path);
+        return -1;
+    }
+
+    setAxis(&spec->gravity, 1.0f);
+    setAxis(&spec->restitution, 0.96f);
+    setAxis(&spec->radius, 0.007f);
+    setAxis(&spec->timestep, 0.05f);
+    spec->particles = 1000;
+    spec->steps = 500;
+    spec->seeds = 1;
+
+    char line[1024];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char name[32];
+        int consumed;
+        if (sscanf(line, " %31[a-z_] = %n", name, &consumed) != 1) continue;
+        char* cursor = line + consumed;
+
+        SweepAxis* axis = strcmp(name, "gravity") == 0 ? &spec->gravity
+                        : strcmp(name, "restitution") == 0 ? &spec->restitution
+                        : strcmp(name, "radius") == 0 ? &spec->radius
+                        : strcmp(name, "timestep") == 0 ? &spec->timestep
+                        : NULL;
+        if (axis) {
+            axis->count = 0;
+            float value;
+            while (sscanf(cursor, "%f%n", &value, &consumed) == 1) {
+                if (axis->count == MAX_SWEEP_VALUES) {
+                    fprintf(stderr, "%s:%d: '%s' has more than %d values\n", path, lineNumber, name, MAX_SWEEP_VALUES);
+                    fclose(file);
+                    return -1;
+                }
+                axis->values[axis->count++] = value;
+                cursor += consumed;
+            }
+        } else {
+            int* scalar = strcmp(name, "particles") == 0 ? &spec->particles
+                        : strcmp(name, "steps") == 0 ? &spec->steps
+                        : strcmp(name, "seeds") == 0 ? &spec->seeds
+                        : NULL;
+            if (!scalar || sscanf(cursor, "%d", scalar) != 1) {
+                fprintf(stderr, "%s:%d: unknown or malformed entry '%s'\n", path, lineNumber, name);
+                fclose(file);
+                return -1;
+            }
+        }
+        if (axis && axis->count == 0) {
+            fprintf(stderr, "%s:%d: '%s' has no values\n", path, lineNumber, name);
+            fclose(file);
+            return -1;
+        }
+    }
+    fclose(file);
+    return spec->particles > 0 && spec->steps >= 0 && spec->seeds > 0 ? 0 : -1;
+}
+
+// Cartesian product of all axes, run ids follow this order so they are stable across restarts
+static SweepRun* expandRuns(const SweepSpec* spec, int* numRuns) {
+    long long total = (long long)spec->gravity.count * spec->restitution.count * spec->radius.count *
+                      spec->timestep.count * spec->seeds;
+    if (total > INT_MAX) {
+        fprintf(stderr, "Sweep has %lld runs, at most %d are supported\n", total, INT_MAX);
+        return NULL;
+    }
+    *numRuns = (int)total;
+    SweepRun* runs = malloc(sizeof(SweepRun) * *numRuns);
+    if (!runs) {
+        fprintf(stderr, "Failed to allocate memory for sweep\n");
+        return NULL;
+    }
+
+    int id = 0;
+    for (int g = 0; g < spec->gravity.count; g++)
+    for (int e = 0; e < spec->restitution.count; e++)
+    for (int r = 0; r < spec->radius.count; r++)
+    for (int t = 0; t < spec->timestep.count; t++)
+    for (int s = 0; s < spec->seeds; s++) {
+        SweepRun* run = &runs[id];
+        run->id = id++;
+        run->seed = (unsigned int)s + 1;
+        run->gravity = spec->gravity.values[g];
+        run->restitution = spec->restitution.values[e];
+        run->radius = spec->radius.values[r];
+        run->timestep = spec->timestep.values[t];
+    }
+    return runs;
+}
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// FNV-1a over everything that decides the run list, so equal hashes mean equal runs per id
+static uint64_t hashSpec(const SweepSpec* spec) {
+    const SweepAxis* axes[] = { &spec->gravity, &spec->restitution, &spec->radius, &spec->timestep };
+    uint64_t hash = 14695981039346656037ULL;
+    for (int a = 0; a < 4; a++) {
+        hash = hashBytes(hash, &axes[a]->count, sizeof(axes[a]->count));
+        hash = hashBytes(hash, axes[a]->values, sizeof(float) * axes[a]->count);
+    }
+    hash = hashBytes(hash, &spec->particles, sizeof(spec->particles));
+    hash = hashBytes(hash, &spec->steps, sizeof(spec->steps));
+    return hashBytes(hash, &spec->seeds, sizeof(spec->seeds));
+}
+
+// Mark runs already present in the results file and drop a trailing partial row from an interrupted
+// write. Returns -1 when the file was written for a different specification, its ids name other runs.
+static int loadCompleted(const char* resultsPath, uint64_t specHash, unsigned char* completed, int numRuns) {
+    FILE* file = fopen(resultsPath, "r");
+    if (!file) return 0;
+
+    char line[1024];
+    unsigned long long fileHash;
+    if (!fgets(line, sizeof(line), file)) {
+        fclose(file);
+        return 0;
+    }
+    if (sscanf(line, "# spec %llx", &fileHash) != 1 || fileHash != specHash) {
+        fprintf(stderr, "Sweep results %s were not written for this specification (spec %016llx), "
+                        "remove them or choose another results file\n", resultsPath, (unsigned long long)specHash);
+        fclose(file);
+        return -1;
+    }
+    long validBytes = (long)strlen(line);
+    int count = 0;
+    while (fgets(line, sizeof(line), file)) {
+        size_t length = strlen(line);
+        if (length == 0 || line[length - 1] != '\n') break;
+        validBytes += (long)length;
+        int id;
+        if (sscanf(line, "%d,", &id) == 1 && id >= 0 && id < numRuns && !completed[id]) {
+            completed[id] = 1;
+            count++;
+        }
+    }
+    fclose(file);
+    if (truncate(resultsPath, validBytes) != 0) {
+        perror("truncate");
+    }
+    return count;
+}
+
+// One run is one instance of the ensemble model, see ensemble.h for how it differs from physics.c
+static void executeRun(Sweep* sweep, const SweepRun* run) {
+    const SweepSpec* spec = sweep->spec;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Ensemble world;
+    if (Ensemble_Init(&world, 1, spec->particles) != 0) {
+        pthread_mutex_lock(&sweep->resultsLock);
+        sweep->finished++;
+        sweep->failed++;
+        fprintf(stderr, "run %d failed (%d/%d)\n", run->id, sweep->finished, sweep->pending);
+        pthread_mutex_unlock(&sweep->resultsLock);
+        return;
+    }
+    Ensemble_FillGrid(&world, SWEEP_GRID_LENGTH, SWEEP_SPACING, run->radius, run->seed);
+    Ensemble_SetParameters(&world, 0, run->gravity, run->restitution, run->timestep);
+    Ensemble_Step(&world, spec->steps);
+
+    double height = 0.0;
+    float maxSpeed = 0.0f;
+    for (int p = 0; p < spec->particles; p++) {
+        height += world.yPos[p];
+        maxSpeed = fmaxf(maxSpeed, sqrtf(world.xVelocity[p] * world.xVelocity[p] +
+                                         world.yVelocity[p] * world.yVelocity[p]));
+    }
+    float energy = Ensemble_KineticEnergy(&world, 0);
+    Ensemble_Destroy(&world);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    // Each row is flushed to disk before the run counts as done
+    pthread_mutex_lock(&sweep->resultsLock);
+    fprintf(sweep->results, "%d,%u,%g,%g,%g,%g,%d,%d,%g,%g,%g,%.3f\n",
+            run->id, run->seed, run->gravity, run->restitution, run->radius, run->timestep,
+            spec->particles, spec->steps, energy, height / spec->particles, maxSpeed, seconds);
+    fflush(sweep->results);
+    fsync(fileno(sweep->results));
+    sweep->finished++;
+    printf("run %d done (%d/%d)\n", run->id, sweep->finished, sweep->pending);
+    pthread_mutex_unlock(&sweep->resultsLock);
+}
+
+static void runRange(int begin, int end, void* context) {
+    Sweep* sweep = context;
+    for (int k = begin; k < end; k++) {
+        executeRun(sweep, &sweep->runs[sweep->pendingRuns[k]]);
+    }
+}
+
+int Sweep_Run(const char* specPath, const char* resultsPath) {
+    SweepSpec spec;
+    if (parseSpec(specPath, &spec) != 0) return -1;
+
+    int numRuns;
+    SweepRun* runs = expandRuns(&spec, &numRuns);
+    if (!runs) return -1;
+    unsigned char* completed = calloc(numRuns > 0 ? numRuns : 1, 1);
+    int* pendingRuns = malloc(sizeof(int) * (numRuns > 0 ? numRuns : 1));
+    if (!completed || !pendingRuns) {
+        fprintf(stderr, "Failed to allocate memory for sweep\n");
+        free(runs);
+        free(completed);
+        free(pendingRuns);
+        return -1;
+    }
+    uint64_t specHash = hashSpec(&spec);
+    int alreadyDone = loadCompleted(resultsPath, specHash, completed, numRuns);
+    if (alreadyDone < 0) {
+        free(runs);
+        free(completed);
+        free(pendingRuns);
+        return -1;
+    }
+
+    Sweep sweep;
+    memset(&sweep, 0, sizeof(sweep));
+    sweep.spec = &spec;
+    sweep.runs = runs;
+    sweep.pendingRuns = pendingRuns;
+    for (int id = 0; id < numRuns; id++) {
+        if (!completed[id]) pendingRuns[sweep.pending++] = id;
+    }
+    printf("Sweep: %d runs, %d already complete, %d threads\n", numRuns, alreadyDone, JobSystem_ThreadCount());
+
+    sweep.results = fopen(resultsPath, "a");
+    if (!sweep.results) {
+        fprintf(stderr, "Could not open sweep results %s\n", resultsPath);
+        free(runs);
+        free(completed);
+        free(pendingRuns);
+        return -1;
+    }
+    fseek(sweep.results, 0, SEEK_END);
+    if (ftell(sweep.results) == 0) {
+        fprintf(sweep.results, "# spec %016llx\n", (unsigned long long)specHash);
+        fprintf(sweep.results, "# runs use the baseline pairwise ensemble model of ensemble.h, not the physics.c solver\n");
+        fprintf(sweep.results, "run,seed,gravity,restitution,radius,timestep,particles,steps,"
+                               "kinetic_energy,mean_height,max_speed,seconds\n");
+    }
+    pthread_mutex_init(&sweep.resultsLock, NULL);
+
+    // Single runs are the grain, idle workers steal the larger remaining ranges
+    JobSystem_ParallelFor(sweep.pending, 1, runRange, &sweep);
+    if (sweep.failed > 0) {
+        fprintf(stderr, "Sweep: %d of %d runs failed, run the sweep again to retry them\n", sweep.failed, sweep.pending);
+    }
+
+    pthread_mutex_destroy(&sweep.resultsLock);
+    fclose(sweep.results);
+    free(runs);
+    free(completed);
+    free(pendingRuns);
+    return sweep.failed > 0 ? -1 : 0;
+}
@@ -0,0 +1,16 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+// Run every parameter combination of a sweep specification headless on the job system.
+// One CSV row of summary metrics is appended to resultsPath per finished run; runs already in
+// the results file are skipped, so an interrupted sweep resumes where it stopped. The file starts
+// with a hash of the specification and is only resumed by the same specification.
+// Runs use the baseline pairwise model of ensemble.h, not the solver of physics.c, so their
+// metrics describe that model; the results file says so in its header.
+//
+// Specification lines are "<name> = <values...>", '#' starts a comment:
+//   gravity = 0.5 1 2        restitution = 0.8 0.96    radius = 0.007
+//   timestep = 0.01 0.05     particles = 1000          steps = 500      seeds = 3
+int Sweep_Run(const char* specPath, const char* resultsPath);
+
+#endif // SWEEP_H
@@ -0,0 +1,486 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trajectory.h"
+#include "jobs.h"
+
+#define CODEC_CHUNK_PARTICLES 65536
+#define CHUNK_BOUND_PER_PARTICLE 10 // two values of at most 40 bits
+#define MAX_UNARY 24                // longer quotients escape to a raw 16-bit value
+#define RICE_RESET 64               // halve the running statistics this often
+
+typedef struct {
+    uint32_t sum, count;            // running magnitude of recent values
+} RiceState;
+
+typedef struct {
+    uint64_t bits;
+    int count;
+    unsigned char* out;
+    size_t position;
+} BitWriter;
+
+typedef struct {
+    uint64_t bits;
+    int count;
+    const unsigned char* in;
+    size_t position, size;
+    int overrun;
+} BitReader;
+
+typedef struct {
+    TrajectoryCodec* codec;
+    const Circle* circles;          // encoding
+    const unsigned char* payload;   // decoding
+    const size_t* chunkOffsets;
+    float* positions;
+    int keyframe;
+    atomic_int failed;
+} ChunkPass;
+
+static uint16_t quantise(float position) {
+    float scaled = (position + 1.0f) * 0.5f * 65535.0f + 0.5f;
+    if (scaled < 0.0f) scaled = 0.0f;
+    if (scaled > 65535.0f) scaled = 65535.0f;
+    return (uint16_t)scaled;
+}
+
+static float dequantise(uint16_t value) {
+    return value * (2.0f / 65535.0f) - 1.0f;
+}
+
+static uint32_t zigzag(uint16_t now, uint16_t before) {
+    int delta = (int16_t)(uint16_t)(now - before);
+    return delta >= 0 ? (uint32_t)delta * 2u : (uint32_t)(-delta) * 2u - 1u;
+}
+
+static uint16_t unzigzag(uint32_t value, uint16_t before) {
+    int delta = (value & 1u) ? -(int)((value + 1u) >> 1) : (int)(value >> 1);
+    return (uint16_t)(before + delta);
+}
+
+static uint32_t spreadBits(uint32_t x) {
+    x &= 0xFFFF;
+    x = (x | (x << 8)) & 0x00FF00FF;
+    x = (x | (x << 4)) & 0x0F0F0F0F;
+    x = (x | (x << 2)) & 0x33333333;
+    x = (x | (x << 1)) & 0x55555555;
+    return x;
+}
+
+static int riceParameter(const RiceState* state) {
+    int k = 0;
+    while (k < 16 && ((uint64_t)state->count << k) < state->sum) k++;
+    return k;
+}
+
+static void riceUpdate(RiceState* state, uint32_t value) {
+    state->sum += value;
+    if (++state->count == RICE_RESET) {
+        state->sum >>= 1;
+        state->count >>= 1;
+    }
+}
+
+static void putBits(BitWriter* writer, uint32_t value, int n) {
+    writer->bits |= (uint64_t)value << writer->count;
+    writer->count += n;
+    while (writer->count >= 8) {
+        writer->out[writer->position++] = (unsigned char)writer->bits;
+        writer->bits >>= 8;
+        writer->count -= 8;
+    }
+}
+
+static void flushBits(BitWriter* writer) {
+    if (writer->count > 0) writer->out[writer->position++] = (unsigned char)writer->bits;
+    writer->bits = 0;
+    writer->count = 0;
+}
+
+static uint32_t getBits(BitReader* reader, int n) {
+    while (reader->count < n) {
+        if (reader->position == reader->size) {
+            reader->overrun = 1;
+            return 0;
+        }
+        reader->bits |= (uint64_t)reader->in[reader->position++] << reader->count;
+        reader->count += 8;
+    }
+    uint32_t value = (uint32_t)(reader->bits & ((1ull << n) - 1));
+    reader->bits >>= n;
+    reader->count -= n;
+    return value;
+}
+
+static void encodeValue(BitWriter* writer, RiceState* state, uint32_t value) {
+    int k = riceParameter(state);
+    uint32_t quotient = value >> k;
+    if (quotient < MAX_UNARY) {
+        putBits(writer, (1u << quotient) - 1u, (int)quotient + 1); // quotient ones and a zero
+        if (k > 0) putBits(writer, value & ((1u << k) - 1u), k);
+    } else {
+        putBits(writer, (1u << MAX_UNARY) - 1u, MAX_UNARY);
+        putBits(writer, value, 16);
+    }
+    riceUpdate(state, value);
+}
+
+static uint32_t decodeValue(BitReader* reader, RiceState* state) {
+    int k = riceParameter(state);
+    uint32_t quotient = 0;
+    while (quotient < MAX_UNARY && getBits(reader, 1)) quotient++;
+    uint32_t value;
+    if (quotient < MAX_UNARY) {
+        value = (quotient << k) | (k > 0 ? getBits(reader, k) : 0u);
+    } else {
+        value = getBits(reader, 16);
+    }
+    riceUpdate(state, value);
+    return value;
+}
+
+// LSD radix sort of the particle indices by the Morton code of codec->previous
+static void buildMortonOrder(TrajectoryCodec* codec) {
+    int n = codec->numParticles;
+    for (int i = 0; i < n; i++) {
+        codec->keys[i] = spreadBits(codec->previous[2 * i]) | (spreadBits(codec->previous[2 * i + 1]) << 1);
+        codec->order[i] = i;
+    }
+    uint32_t* keys = codec->keys;
+    uint32_t* keysOut = codec->keyScratch;
+    int* order = codec->order;
+    int* orderOut = codec->orderScratch;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int counts[257] = {0};
+        for (int i = 0; i < n; i++) counts[((keys[i] >> shift) & 0xFF) + 1]++;
+        for (int d = 0; d < 256; d++) counts[d + 1] += counts[d];
+        for (int i = 0; i < n; i++) {
+            int slot = counts[(keys[i] >> shift) & 0xFF]++;
+            keysOut[slot] = keys[i];
+            orderOut[slot] = order[i];
+        }
+        uint32_t* keysSwap = keys; keys = keysOut; keysOut = keysSwap;
+        int* orderSwap = order; order = orderOut; orderOut = orderSwap;
+    }
+    // An even number of passes leaves the result in the original arrays
+}
+
+// The coded frame becomes the reference of the next one
+static void advanceFrame(TrajectoryCodec* codec) {
+    uint16_t* swap = codec->previous;
+    codec->previous = codec->current;
+    codec->current = swap;
+    codec->havePrevious = 1;
+    buildMortonOrder(codec);
+}
+
+static void chunkRange(const TrajectoryCodec* codec, int chunk, int* begin, int* end) {
+    *begin = chunk * CODEC_CHUNK_PARTICLES;
+    *end = *begin + CODEC_CHUNK_PARTICLES < codec->numParticles ? *begin + CODEC_CHUNK_PARTICLES : codec->numParticles;
+}
+
+static void encodeChunks(int firstChunk, int lastChunk, void* context) {
+    ChunkPass* pass = context;
+    TrajectoryCodec* codec = pass->codec;
+    for (int chunk = firstChunk; chunk < lastChunk; chunk++) {
+        int begin, end;
+        chunkRange(codec, chunk, &begin, &end);
+        BitWriter writer = { 0, 0, codec->chunkData + (size_t)begin * CHUNK_BOUND_PER_PARTICLE, 0 };
+        RiceState xState = { 4, 1 }, yState = { 4, 1 };
+        uint16_t xBefore = 0, yBefore = 0;
+
+        for (int k = begin; k < end; k++) {
+            int p = pass->keyframe ? k : codec->order[k];
+            uint16_t x = quantise(pass->circles[p].xPos);
+            uint16_t y = quantise(pass->circles[p].yPos);
+            codec->current[2 * p] = x;
+            codec->current[2 * p + 1] = y;
+            if (!pass->keyframe) {
+                xBefore = codec->previous[2 * p];
+                yBefore = codec->previous[2 * p + 1];
+            }
+            encodeValue(&writer, &xState, zigzag(x, xBefore));
+            encodeValue(&writer, &yState, zigzag(y, yBefore));
+            if (pass->keyframe) {
+                xBefore = x;
+                yBefore = y;
+            }
+        }
+        flushBits(&writer);
+        codec->chunkBytes[chunk] = (uint32_t)writer.position;
+    }
+}
+
+static void decodeChunks(int firstChunk, int lastChunk, void* context) {
+    ChunkPass* pass = context;
+    TrajectoryCodec* codec = pass->codec;
+    for (int chunk = firstChunk; chunk < lastChunk; chunk++) {
+        int begin, end;
+        chunkRange(codec, chunk, &begin, &end);
+        BitReader reader = { 0, 0, pass->payload + pass->chunkOffsets[chunk], 0, codec->chunkBytes[chunk], 0 };
+        RiceState xState = { 4, 1 }, yState = { 4, 1 };
+        uint16_t xBefore = 0, yBefore = 0;
+
+        for (int k = begin; k < end; k++) {
+            int p = pass->keyframe ? k : codec->order[k];
+            if (!pass->keyframe) {
+                xBefore = codec->previous[2 * p];
+                yBefore = codec->previous[2 * p + 1];
+            }
+            uint16_t x = unzigzag(decodeValue(&reader, &xState), xBefore);
+            uint16_t y = unzigzag(decodeValue(&reader, &yState), yBefore);
+            codec->current[2 * p] = x;
+            codec->current[2 * p + 1] = y;
+            pass->positions[2 * p] = dequantise(x);
+            pass->positions[2 * p + 1] = dequantise(y);
+            if (pass->keyframe) {
+                xBefore = x;
+                yBefore = y;
+            }
+        }
+        if (reader.overrun) atomic_store(&pass->failed, 1);
+    }
+}
+
+int TrajectoryCodec_Init(TrajectoryCodec* codec, int numParticles, int keyframeInterval) {
+    memset(codec, 0, sizeof(*codec));
+    codec->numParticles = numParticles;
+    codec->keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+    codec->numChunks = (numParticles + CODEC_CHUNK_PARTICLES - 1) / CODEC_CHUNK_PARTICLES;
+
+    size_t n = numParticles > 0 ? (size_t)numParticles : 1;
+    size_t bound = n * CHUNK_BOUND_PER_PARTICLE + 8;
+    codec->previous = malloc(sizeof(uint16_t) * 2 * n);
+    codec->current = malloc(sizeof(uint16_t) * 2 * n);
+    codec->order = malloc(sizeof(int) * n);
+    codec->orderScratch = malloc(sizeof(int) * n);
+    codec->keys = malloc(sizeof(uint32_t) * n);
+    codec->keyScratch = malloc(sizeof(uint32_t) * n);
+    codec->chunkData = malloc(bound);
+    codec->chunkBytes = malloc(sizeof(uint32_t) * (codec->numChunks + 1));
+    codec->payload = malloc(sizeof(uint32_t) * (codec->numChunks + 1) + bound);
+    if (!codec->previous || !codec->current || !codec->order || !codec->orderScratch || !codec->keys ||
+        !codec->keyScratch || !codec->chunkData || !codec->chunkBytes || !codec->payload) {
+        fprintf(stderr, "Failed to allocate memory for trajectory codec\n");
+        TrajectoryCodec_Destroy(codec);
+        return -1;
+    }
+    return 0;
+}
+
+// Payload: chunk count, the coded size of every chunk, then the chunks back to back
+size_t TrajectoryCodec_Encode(TrajectoryCodec* codec, const Circle* circles, uint32_t* flags) {
+    ChunkPass pass;
+    memset(&pass, 0, sizeof(pass));
+    pass.codec = codec;
+    pass.circles = circles;
+    pass.keyframe = !codec->havePrevious || codec->framesSinceKeyframe >= codec->keyframeInterval;
+    if (pass.keyframe) codec->framesSinceKeyframe = 0;
+    codec->framesSinceKeyframe++;
+    JobSystem_ParallelFor(codec->numChunks, 1, encodeChunks, &pass);
+
+    uint32_t numChunks = (uint32_t)codec->numChunks;
+    memcpy(codec->payload, &numChunks, sizeof(numChunks));
+    memcpy(codec->payload + sizeof(uint32_t), codec->chunkBytes, sizeof(uint32_t) * numChunks);
+    size_t size = sizeof(uint32_t) * (numChunks + 1);
+    for (int chunk = 0; chunk < codec->numChunks; chunk++) {
+        memcpy(codec->payload + size,
+               codec->chunkData + (size_t)chunk * CODEC_CHUNK_PARTICLES * CHUNK_BOUND_PER_PARTICLE,
+               codec->chunkBytes[chunk]);
+        size += codec->chunkBytes[chunk];
+    }
+
+    advanceFrame(codec);
+    *flags = pass.keyframe ? TRAJECTORY_KEYFRAME : 0u;
+    return size;
+}
+
+int TrajectoryCodec_Decode(TrajectoryCodec* codec, const unsigned char* payload, size_t size,
+                           uint32_t flags, float* positions) {
+    int keyframe = (flags & TRAJECTORY_KEYFRAME) != 0;
+    if (!keyframe && !codec->havePrevious) return -1;
+
+    uint32_t numChunks;
+    size_t tableSize = sizeof(uint32_t) * (codec->numChunks + 1);
+    if (size < tableSize) return -1;
+    memcpy(&numChunks, payload, sizeof(numChunks));
+    if (numChunks != (uint32_t)codec->numChunks) return -1;
+    memcpy(codec->chunkBytes, payload + sizeof(uint32_t), sizeof(uint32_t) * numChunks);
+
+    size_t* chunkOffsets = malloc(sizeof(size_t) * (numChunks + 1));
+    if (!chunkOffsets) return -1;
+    size_t offset = tableSize;
+    for (uint32_t chunk = 0; chunk < numChunks; chunk++) {
+        chunkOffsets[chunk] = offset;
+        offset += codec->chunkBytes[chunk];
+    }
+    if (offset > size) {
+        free(chunkOffsets);
+        return -1;
+    }
+
+    ChunkPass pass;
+    memset(&pass, 0, sizeof(pass));
+    pass.codec = codec;
+    pass.payload = payload;
+    pass.chunkOffsets = chunkOffsets;
+    pass.positions = positions;
+    pass.keyframe = keyframe;
+    JobSystem_ParallelFor(codec->numChunks, 1, decodeChunks, &pass);
+    free(chunkOffsets);
+    if (atomic_load(&pass.failed)) {
+        codec->havePrevious = 0;
+        return -1;
+    }
+    advanceFrame(codec);
+    return 0;
+}
+
+void TrajectoryCodec_Destroy(TrajectoryCodec* codec) {
+    free(codec->previous);
+    free(codec->current);
+    free(codec->order);
+    free(codec->orderScratch);
+    free(codec->keys);
+    free(codec->keyScratch);
+    free(codec->chunkData);
+    free(codec->chunkBytes);
+    free(codec->payload);
+    memset(codec, 0, sizeof(*codec));
+}
+
+int Trajectory_Open(Trajectory* trajectory, const char* path) {
+    memset(trajectory, 0, sizeof(*trajectory));
+    trajectory->decodedFrame = -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not read trajectory %s\n", path);
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TrajectoryHeader)) {
+        fprintf(stderr, "Trajectory %s is truncated\n", path);
+        close(fd);
+        return -1;
+    }
+    void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Could not map trajectory %s\n", path);
+        return -1;
+    }
+    trajectory->mapping = mapping;
+    trajectory->mappingSize = (size_t)info.st_size;
+
+    const TrajectoryHeader* header = mapping;
+    if (memcmp(header->magic, TRAJECTORY_MAGIC, 4) != 0 ||
+        (header->version != TRAJECTORY_VERSION && header->version != 2) ||
+        header->numParticles <= 0 || header->encoding > TRAJECTORY_QUANTISED) {
+        fprintf(stderr, "Trajectory %s is invalid or from an incompatible version\n", path);
+        Trajectory_Close(trajectory);
+        return -1;
+    }
+    trajectory->header = header;
+    size_t offset = sizeof(TrajectoryHeader);
+    if (header->version >= 3) {
+        size_t radiiBytes = sizeof(float) * (size_t)header->numParticles;
+        if (trajectory->mappingSize - offset < radiiBytes) {
+            fprintf(stderr, "Trajectory %s is truncated\n", path);
+            Trajectory_Close(trajectory);
+            return -1;
+        }
+        trajectory->radii = (const float*)(trajectory->mapping + offset);
+        offset += radiiBytes;
+    }
+
+    // Frame index, built by hopping over the frame headers
+    int capacity = 1024;
+    trajectory->frameOffsets = malloc(sizeof(size_t) * capacity);
+    while (trajectory->frameOffsets && offset + sizeof(TrajectoryFrameHeader) <= trajectory->mappingSize) {
+        TrajectoryFrameHeader frame;
+        memcpy(&frame, trajectory->mapping + offset, sizeof(frame));
+        size_t end = offset + sizeof(frame) + frame.payloadBytes;
+        if (end > trajectory->mappingSize) break;
+        if (frame.activeCount < 0 || frame.activeCount > header->numParticles) break;
+        if (trajectory->numFrames == capacity) {
+            capacity *= 2;
+            size_t* grown = realloc(trajectory->frameOffsets, sizeof(size_t) * capacity);
+            if (!grown) break;
+            trajectory->frameOffsets = grown;
+        }
+        trajectory->frameOffsets[trajectory->numFrames++] = offset;
+        offset = end;
+    }
+
+    int n = header->numParticles;
+    trajectory->decoded = malloc(sizeof(float) * 2 * (size_t)n);
+    int codecFailed = header->encoding == TRAJECTORY_QUANTISED &&
+                      TrajectoryCodec_Init(&trajectory->codec, n, 1) != 0;
+    if (!trajectory->frameOffsets || !trajectory->decoded || codecFailed) {
+        fprintf(stderr, "Failed to allocate memory for trajectory playback\n");
+        Trajectory_Close(trajectory);
+        return -1;
+    }
+    return 0;
+}
+
+// Quantised payloads have arbitrary lengths, so frame headers may be unaligned
+static TrajectoryFrameHeader frameHeader(const Trajectory* trajectory, int frame) {
+    TrajectoryFrameHeader header;
+    memcpy(&header, trajectory->mapping + trajectory->frameOffsets[frame], sizeof(header));
+    return header;
+}
+
+static const unsigned char* framePayload(const Trajectory* trajectory, int frame) {
+    return trajectory->mapping + trajectory->frameOffsets[frame] + sizeof(TrajectoryFrameHeader);
+}
+
+const float* Trajectory_Frame(Trajectory* trajectory, int frame, long long* step, int* activeCount) {
+    if (frame < 0 || frame >= trajectory->numFrames) return NULL;
+    TrajectoryFrameHeader header = frameHeader(trajectory, frame);
+    if (step) *step = header.step;
+    if (activeCount) *activeCount = header.activeCount;
+    if (trajectory->header->encoding == TRAJECTORY_RAW) {
+        return (const float*)framePayload(trajectory, frame);
+    }
+    if (frame == trajectory->decodedFrame) {
+        return trajectory->decoded;
+    }
+
+    // Decode forward from the closest keyframe, or from the last decoded frame when that is closer
+    int first = frame;
+    while (first > 0 && !(frameHeader(trajectory, first).flags & TRAJECTORY_KEYFRAME)) first--;
+    if (trajectory->decodedFrame >= first && trajectory->decodedFrame < frame) {
+        first = trajectory->decodedFrame + 1;
+    }
+    for (int f = first; f <= frame; f++) {
+        TrajectoryFrameHeader header = frameHeader(trajectory, f);
+        if (TrajectoryCodec_Decode(&trajectory->codec, framePayload(trajectory, f), header.payloadBytes,
+                                   header.flags, trajectory->decoded) != 0) {
+            fprintf(stderr, "Trajectory frame %d is corrupt\n", f);
+            trajectory->decodedFrame = -1;
+            return NULL;
+        }
+    }
+    trajectory->decodedFrame = frame;
+    return trajectory->decoded;
+}
+
+void Trajectory_Close(Trajectory* trajectory) {
+    if (trajectory->header && trajectory->header->encoding == TRAJECTORY_QUANTISED) {
+        TrajectoryCodec_Destroy(&trajectory->codec);
+    }
+    if (trajectory->mapping) munmap((void*)trajectory->mapping, trajectory->mappingSize);
+    free(trajectory->frameOffsets);
+    free(trajectory->decoded);
+    memset(trajectory, 0, sizeof(*trajectory));
+    trajectory->decodedFrame = -1;
+}
@@ -0,0 +1,98 @@
+#ifndef TRAJECTORY_H
+#define TRAJECTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "circle.h"
+
+#define TRAJECTORY_MAGIC "FTRJ"
+#define TRAJECTORY_VERSION 3
+
+typedef enum {
+    TRAJECTORY_RAW = 0,     // interleaved float32 x, y per active particle
+    TRAJECTORY_QUANTISED = 1 // 16-bit positions, delta and Rice coded by TrajectoryCodec
+} TrajectoryEncoding;
+
+#define TRAJECTORY_KEYFRAME 1u // frame flag: decodes without the previous frame
+
+// Little-endian file header, followed by the float32 radius of every particle, then one frame after
+// another until the end of the file. Version 2 files have no radii.
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    int32_t numParticles;
+    int32_t every;          // simulation steps between recorded frames
+    uint32_t encoding;      // TrajectoryEncoding
+    uint32_t reserved;
+} TrajectoryHeader;
+
+// Precedes the payloadBytes bytes of every frame
+typedef struct {
+    int64_t step;
+    uint32_t payloadBytes;
+    uint32_t flags;
+    int32_t activeCount;    // particles in the simulation at this step, the first ones by index
+    uint32_t reserved;
+} TrajectoryFrameHeader;
+
+// Quantised encoding. Positions become 16-bit fixed point over the [-1, 1] domain. Keyframes code
+// each particle against the previous particle index. Other frames code each particle against its
+// own position in the previous frame, visiting particles in the Morton order of that frame so that
+// neighbours with similar motion sit next to each other for the adaptive Rice coder. Both sides
+// derive the order from the previous frame, so it is never stored. The payload is split into
+// independently coded chunks that are encoded and decoded in parallel.
+typedef struct {
+    int numParticles;
+    int keyframeInterval;
+    int framesSinceKeyframe;
+    int havePrevious;
+    uint16_t* previous;     // quantised x, y of the last frame coded, by particle index
+    uint16_t* current;
+    int* order;             // Morton order of previous
+    int* orderScratch;
+    uint32_t* keys;
+    uint32_t* keyScratch;
+    unsigned char* chunkData;   // worst-case sized area per chunk
+    uint32_t* chunkBytes;
+    int numChunks;
+    unsigned char* payload;
+} TrajectoryCodec;
+
+int TrajectoryCodec_Init(TrajectoryCodec* codec, int numParticles, int keyframeInterval);
+
+// Encode one frame into codec->payload and return its size; flags receives TRAJECTORY_KEYFRAME
+// when the frame is a keyframe
+size_t TrajectoryCodec_Encode(TrajectoryCodec* codec, const Circle* circles, uint32_t* flags);
+
+// Decode one frame into interleaved x, y positions. A frame without TRAJECTORY_KEYFRAME must follow
+// the frame decoded just before it. Returns -1 for a corrupt payload.
+int TrajectoryCodec_Decode(TrajectoryCodec* codec, const unsigned char* payload, size_t size,
+                           uint32_t flags, float* positions);
+
+void TrajectoryCodec_Destroy(TrajectoryCodec* codec);
+
+// A recorded trajectory file mapped read-only for playback
+typedef struct {
+    const TrajectoryHeader* header;
+    const float* radii;     // numParticles radii of the recorded run, NULL for version 2 files
+    const unsigned char* mapping;
+    size_t mappingSize;
+    size_t* frameOffsets;   // file offset of every complete frame header
+    int numFrames;
+    TrajectoryCodec codec;  // quantised files only
+    float* decoded;         // positions of decodedFrame
+    int decodedFrame;
+} Trajectory;
+
+// Map a trajectory and index its frames, a partially written last frame is ignored
+int Trajectory_Open(Trajectory* trajectory, const char* path);
+
+// Interleaved x, y positions of a frame, valid until the next call. Only the first activeCount
+// particles were in the simulation at that step. Raw frames point straight into the mapping;
+// quantised frames decode forward from the closest keyframe unless frame follows the previously
+// returned one.
+const float* Trajectory_Frame(Trajectory* trajectory, int frame, long long* step, int* activeCount);
+
+void Trajectory_Close(Trajectory* trajectory);
+
+#endif // TRAJECTORY_H
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "vtk_export.h"
+
+#define EXPORT_CHUNK 4096                  // particles gathered per fwrite
+#define EXPORT_BUFFER_BYTES ((size_t)1 << 20)
+#define PVD_FOOTER "  </Collection>\n</VTKFile>\n"
+
+typedef enum {
+    FIELD_POINTS,
+    FIELD_VELOCITY,
+    FIELD_RADIUS,
+    FIELD_SPEED,
+    FIELD_DENSITY,
+    FIELD_PRESSURE,
+    NUM_FIELDS
+} ExportField;
+
+static const char* const fieldNames[NUM_FIELDS] = { "Points", "velocity", "radius", "speed", "density", "pressure" };
+static const int fieldComponents[NUM_FIELDS] = { 3, 3, 1, 1, 1, 1 };
+
+static int hostIsLittleEndian(void) {
+    const uint16_t probe = 1;
+    return *(const unsigned char*)&probe == 1;
+}
+
+static void gatherField(ExportField field, const Circle* circles, const float* density, const float* pressure,
+                        int begin, int count, float* out) {
+    for (int k = 0; k < count; k++) {
+        const Circle* c = &circles[begin + k];
+        switch (field) {
+            case FIELD_POINTS:
+                out[3 * k] = c->xPos;
+                out[3 * k + 1] = c->yPos;
+                out[3 * k + 2] = 0.0f;
+                break;
+            case FIELD_VELOCITY:
+                out[3 * k] = c->xVelocity;
+                out[3 * k + 1] = c->yVelocity;
+                out[3 * k + 2] = 0.0f;
+                break;
+            case FIELD_RADIUS: out[k] = c->radius; break;
+            case FIELD_SPEED: out[k] = sqrtf(c->xVelocity * c->xVelocity + c->yVelocity * c->yVelocity); break;
+            case FIELD_DENSITY: out[k] = density[begin + k]; break;
+            default: out[k] = pressure[begin + k]; break;
+        }
+    }
+}
+
+static void writeDataArray(FILE* file, ExportField field, uint64_t offset) {
+    if (field == FIELD_POINTS) {
+        fprintf(file, "        <DataArray type=\"Float32\" NumberOfComponents=\"3\" format=\"appended\" offset=\"%llu\"/>\n",
+                (unsigned long long)offset);
+    } else {
+        fprintf(file, "        <DataArray type=\"Float32\" Name=\"%s\" NumberOfComponents=\"%d\" format=\"appended\" offset=\"%llu\"/>\n",
+                fieldNames[field], fieldComponents[field], (unsigned long long)offset);
+    }
+}
+
+int VTKSeries_Open(VTKSeries* series, const char* basePath) {
+    memset(series, 0, sizeof(*series));
+    if (!hostIsLittleEndian()) {
+        fprintf(stderr, "VTK export is only supported on little-endian hosts\n");
+        return -1;
+    }
+    snprintf(series->basePath, sizeof(series->basePath), "%s", basePath);
+
+    char indexPath[1100];
+    snprintf(indexPath, sizeof(indexPath), "%s.pvd", basePath);
+    series->index = fopen(indexPath, "w");
+    if (!series->index) {
+        fprintf(stderr, "Could not write VTK index %s\n", indexPath);
+        return -1;
+    }
+    fprintf(series->index, "<?xml version=\"1.0\"?>\n"
+                           "<VTKFile type=\"Collection\" version=\"0.1\" byte_order=\"LittleEndian\">\n"
+                           "  <Collection>\n");
+    series->footerOffset = ftell(series->index);
+    fputs(PVD_FOOTER, series->index);
+    fflush(series->index);
+    return 0;
+}
+
+int VTKSeries_Write(VTKSeries* series, const Circle* circles, int numCircles,
+                    const float* density, const float* pressure, long long step, double time) {
+    char path[1100];
+    snprintf(path, sizeof(path), "%s_%06lld.vtp", series->basePath, step);
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not write VTK file %s\n", path);
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, EXPORT_BUFFER_BYTES);
+
+    bool present[NUM_FIELDS];
+    uint64_t offsets[NUM_FIELDS];
+    uint64_t offset = 0;
+    for (int f = 0; f < NUM_FIELDS; f++) {
+        present[f] = (f != FIELD_DENSITY || density) && (f != FIELD_PRESSURE || pressure);
+        offsets[f] = offset;
+        if (present[f]) offset += sizeof(uint64_t) + sizeof(float) * fieldComponents[f] * (uint64_t)numCircles;
+    }
+
+    fprintf(file, "<?xml version=\"1.0\"?>\n"
+                  "<VTKFile type=\"PolyData\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n"
+                  "  <PolyData>\n"
+                  "    <Piece NumberOfPoints=\"%d\" NumberOfVerts=\"0\" NumberOfLines=\"0\" NumberOfStrips=\"0\" NumberOfPolys=\"0\">\n"
+                  "      <PointData Scalars=\"speed\" Vectors=\"velocity\">\n", numCircles);
+    for (int f = FIELD_VELOCITY; f < NUM_FIELDS; f++) {
+        if (present[f]) writeDataArray(file, (ExportField)f, offsets[f]);
+    }
+    fprintf(file, "      </PointData>\n      <Points>\n");
+    writeDataArray(file, FIELD_POINTS, offsets[FIELD_POINTS]);
+    fprintf(file, "      </Points>\n    </Piece>\n  </PolyData>\n  <AppendedData encoding=\"raw\">\n_");
+
+    // Each block is its byte count followed by the values, gathered from the particles in chunks
+    float chunk[3 * EXPORT_CHUNK];
+    for (int f = 0; f < NUM_FIELDS; f++) {
+        if (!present[f]) continue;
+        uint64_t bytes = sizeof(float) * fieldComponents[f] * (uint64_t)numCircles;
+        fwrite(&bytes, sizeof(bytes), 1, file);
+        for (int begin = 0; begin < numCircles; begin += EXPORT_CHUNK) {
+            int count = numCircles - begin < EXPORT_CHUNK ? numCircles - begin : EXPORT_CHUNK;
+            gatherField((ExportField)f, circles, density, pressure, begin, count, chunk);
+            fwrite(chunk, sizeof(float) * fieldComponents[f], (size_t)count, file);
+        }
+    }
+    fprintf(file, "\n  </AppendedData>\n</VTKFile>\n");
+    if (ferror(file) | fclose(file)) {
+        fprintf(stderr, "Failed to write VTK file %s\n", path);
+        return -1;
+    }
+
+    // Replace the closing tags with the new entry and write them again, so the index stays loadable
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    fseek(series->index, series->footerOffset, SEEK_SET);
+    fprintf(series->index, "    <DataSet timestep=\"%.9g\" group=\"\" part=\"0\" file=\"%s\"/>\n", time, name);
+    series->footerOffset = ftell(series->index);
+    fputs(PVD_FOOTER, series->index);
+    fflush(series->index);
+    series->numFiles++;
+    return 0;
+}
+
+void VTKSeries_Close(VTKSeries* series) {
+    if (series->index) fclose(series->index);
+    series->index = NULL;
+}
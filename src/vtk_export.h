@@ -0,0 +1,25 @@
+#ifndef VTK_EXPORT_H
+#define VTK_EXPORT_H
+
+#include <stdio.h>
+#include "circle.h"
+
+// Time series of VTK XML PolyData files for ParaView: <base>_<step>.vtp per exported step, all
+// listed in <base>.pvd. Point data is velocity, radius, speed and, when given, density and pressure,
+// stored as appended raw little-endian binary.
+typedef struct {
+    char basePath[1024];
+    FILE* index;            // the .pvd file, kept valid after every step
+    long footerOffset;      // where the next entry overwrites the closing tags
+    int numFiles;
+} VTKSeries;
+
+int VTKSeries_Open(VTKSeries* series, const char* basePath);
+
+// density and pressure may be NULL to leave those fields out
+int VTKSeries_Write(VTKSeries* series, const Circle* circles, int numCircles,
+                    const float* density, const float* pressure, long long step, double time);
+
+void VTKSeries_Close(VTKSeries* series);
+
+#endif // VTK_EXPORT_H
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "physics.h"
+#include "fluidsim.h"
+#include "barnes_hut.h"
+#include "jobs.h"
+
+#define TIMESTEP 0.01f
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fprintf(stderr, "\n"); \
+        failures++; \
+    } \
+} while (0)
+
+// Resting lattice of small particles with every stride-th particle moving fast
+static void fillLattice(Circle* circles, int numCircles, int stride, float fastSpeed) {
+    for (int i = 0; i < numCircles; i++) {
+        Circle* c = &circles[i];
+        c->xPos = -0.9f + (i % 100) * 0.018f;
+        c->yPos = -0.9f + (i / 100) * 0.018f;
+        c->radius = 0.004f;
+        c->xVelocity = i % stride == 0 ? fastSpeed : 0.0f;
+        c->yVelocity = 0.0f;
+    }
+}
+
+static long long stepUpdates(Circle* circles, int numCircles, int steps) {
+    PhysicsStats before, after;
+    getPhysicsStats(&before);
+    for (int s = 0; s < steps; s++) updatePosition(circles, numCircles, TIMESTEP);
+    getPhysicsStats(&after);
+    return after.particleUpdates - before.particleUpdates;
+}
+
+// A few fast particles must not make every substep revisit the slow majority
+static void testMultiRateCost(void) {
+    enum { N = 5000, STEPS = 10, LEVELS = 4 };
+    Circle* circles = allocateCircles(N);
+    setGravity(0.0f);
+
+    setTimestepBins(0);
+    fillLattice(circles, N, 500, 2.0f);
+    long long singleRate = stepUpdates(circles, N, STEPS);
+
+    setTimestepBins(LEVELS);
+    fillLattice(circles, N, 500, 2.0f);
+    long long multiRate = stepUpdates(circles, N, STEPS);
+
+    printf("multi-rate cost: %lld particle updates single-rate, %lld with %d levels\n",
+           singleRate, multiRate, LEVELS);
+    CHECK(multiRate < 2 * singleRate, "%lld updates with %d levels against %lld single-rate",
+          multiRate, LEVELS, singleRate);
+
+    setTimestepBins(0);
+    setGravity(1.0f);
+    freeCircles(circles, N);
+}
+
+// Overlapping particles packed into a corner, so the first contacts push hard against the walls
+static void fillDenseCorner(Circle* circles, int numCircles) {
+    for (int i = 0; i < numCircles; i++) {
+        Circle* c = &circles[i];
+        c->xPos = -0.99f + (i % 75) * 0.002f;
+        c->yPos = -0.99f + (i / 75) * 0.002f;
+        c->radius = 0.006f;
+        c->xVelocity = -0.5f;
+        c->yVelocity = -0.5f;
+    }
+}
+
+static int countOutside(const Circle* circles, int numCircles) {
+    int outside = 0;
+    for (int i = 0; i < numCircles; i++) {
+        const Circle* c = &circles[i];
+        if (!(c->xPos >= -1.0f && c->xPos <= 1.0f && c->yPos >= -1.0f && c->yPos <= 1.0f)) outside++;
+    }
+    return outside;
+}
+
+// Contact corrections must never leave a particle outside the window, on walls or periodic axes
+static void testDenseStartStaysInDomain(void) {
+    enum { N = 5000, STEPS = 30 };
+    Circle* circles = allocateCircles(N);
+    for (int periodic = 0; periodic <= 1; periodic++) {
+        for (int levels = 0; levels <= 3; levels += 3) {
+            setPeriodicBoundaries(periodic, periodic);
+            setTimestepBins(levels);
+            fillDenseCorner(circles, N);
+            int outside = 0;
+            for (int s = 0; s < STEPS; s++) {
+                updatePosition(circles, N, TIMESTEP);
+                outside += countOutside(circles, N);
+            }
+            CHECK(outside == 0, "%d particle-steps outside the domain (periodic %d, %d levels)",
+                  outside, periodic, levels);
+        }
+    }
+    setPeriodicBoundaries(false, false);
+    setTimestepBins(0);
+    freeCircles(circles, N);
+}
+
+// On periodic axes the long-range force acts through the nearest image, across the seam
+static void testLongRangeAcrossSeam(void) {
+    enum { N = 2000 };
+    Circle* circles = allocateCircles(N);
+    for (int i = 0; i < N; i++) {
+        // Half the particles spread over the domain, half in a band against the right wall, so the
+        // band pulls on everything through the seam
+        circles[i].xPos = -1.0f + 2.0f * ((i * 7919) % N) / N;
+        circles[i].yPos = -1.0f + 2.0f * ((i * 104729) % N) / N;
+        if (i % 2) circles[i].xPos = 0.9f + 0.1f * circles[i].xPos;
+        circles[i].radius = 0.005f;
+    }
+    float* acc = malloc(sizeof(float) * 2 * N);
+    QuadTree tree = { 0 };
+    QuadTree_Build(&tree, circles, N);
+    QuadTree_Accelerations(&tree, circles, N, 1.0f, 0.5f, 2.0f, 2.0f, acc, acc + N);
+
+    double error = 0.0, norm = 0.0;
+    for (int i = 0; i < N; i++) {
+        float softening = circles[i].radius * circles[i].radius;
+        double ax = 0.0, ay = 0.0;
+        for (int j = 0; j < N; j++) {
+            if (j == i) continue;
+            float dx = circles[j].xPos - circles[i].xPos;
+            float dy = circles[j].yPos - circles[i].yPos;
+            dx -= 2.0f * roundf(dx / 2.0f);
+            dy -= 2.0f * roundf(dy / 2.0f);
+            double r2 = dx * dx + dy * dy + softening;
+            double inverse = circles[j].radius * circles[j].radius / (r2 * sqrt(r2));
+            ax += dx * inverse;
+            ay += dy * inverse;
+        }
+        error += (acc[i] - ax) * (acc[i] - ax) + (acc[N + i] - ay) * (acc[N + i] - ay);
+        norm += ax * ax + ay * ay;
+    }
+    CHECK(error < 1e-3 * norm, "periodic Barnes-Hut off the nearest-image sum by %g relative",
+          sqrt(error / norm));
+    QuadTree_Destroy(&tree);
+    free(acc);
+    freeCircles(circles, N);
+}
+
+// The default lattice has to fit the domain for any particle count the library accepts
+static void testLargeLatticeStartsInDomain(void) {
+    FluidWorldDesc desc = { .numParticles = 100000 };
+    FluidWorld* world = FluidWorld_Create(&desc);
+    CHECK(world != NULL, "could not create a world of %d particles", desc.numParticles);
+    if (!world) return;
+    const Circle* circles = FluidWorld_Circles(world);
+    int count = FluidWorld_ActiveCount(world);
+    int outside = countOutside(circles, count);
+    CHECK(outside == 0, "%d of %d lattice particles start outside the domain", outside, count);
+    CHECK(circles[1].xPos > circles[0].xPos, "lattice spacing collapsed to %g",
+          circles[1].xPos - circles[0].xPos);
+    FluidWorld_Step(world, 1);
+    outside = countOutside(circles, count);
+    CHECK(outside == 0, "%d of %d particles outside the domain after one step", outside, count);
+    FluidWorld_Destroy(world);
+}
+
+int main(void) {
+    JobSystem_Init(0);
+    testMultiRateCost();
+    testDenseStartStaysInDomain();
+    testLongRangeAcrossSeam();
+    testLargeLatticeStartsInDomain();
+    JobSystem_Shutdown();
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all physics tests passed\n");
+    return 0;
+}